@@ -4,6 +4,8 @@
 #include <string.h>
 #include <time.h>
 
+#include "minidoom.h"
+
 // --- Platform-specific includes for non-blocking input ---
 #ifdef _WIN32
 #include <conio.h>
@@ -12,6 +14,9 @@
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 #endif
 
 // --- ANSI Color Codes and Control Sequences ---
@@ -31,46 +36,476 @@
 #define ANSI_SHOW_CURSOR "\x1b[?25h"
 
 // --- Game Constants ---
-#define MAP_WIDTH  20
+#define MAP_WIDTH  20          // Built-in level, and the minimap window
 #define MAP_HEIGHT 20
+#define MAP_MAX_WIDTH  128     // Largest level that can be loaded
+#define MAP_MAX_HEIGHT 128
+#define MAX_GAME_OBJECTS 1024  // Health, ammo and enemies a session holds; a large Doom map fits
+#define MAX_DOORS 512          // Door cells a session animates
 #define SCREEN_WIDTH 100
 #define SCREEN_HEIGHT 30
 #define FOV_DEGREES 66.0f
 #define FOV_RADIANS (FOV_DEGREES * M_PI / 180.0f)
-#define PLAYER_MOVE_SPEED 0.15f
-#define PLAYER_ROT_SPEED 0.05f
+#define PLAYER_MOVE_SPEED 3.0f    // Top speed in map units per second
+#define PLAYER_ROT_SPEED 2.2f     // Top turn rate in radians per second
+#define PLAYER_ACCEL 24.0f        // Units per second^2 toward the wished velocity
+#define PLAYER_FRICTION 14.0f     // Units per second^2 of braking with no movement keys held
+#define PLAYER_TURN_ACCEL 18.0f   // Radians per second^2 toward the wished turn rate
+#define PLAYER_PITCH_STEP 0.05f   // Horizon shift per look action, in view heights
+#define PLAYER_MAX_PITCH 0.5f     // Furthest the horizon moves from the middle of the view
+#define PLAYER_EYE_HEIGHT 0.5f    // Standing eye height, in wall heights
+#define PLAYER_CROUCH_HEIGHT 0.25f
+#define PLAYER_STANCE_SPEED 2.0f  // Wall heights per second the eye moves between stances
+#define PLAYER_JUMP_SPEED 2.0f    // Take-off speed in wall heights per second
+#define PLAYER_GRAVITY 9.0f       // Wall heights per second^2; a jump peaks about 0.2 up
+#define TICK_SECONDS 0.05         // Fixed simulation step (20 ticks per second)
+#define MAX_TICKS_PER_FRAME 4     // Cap on catch-up ticks after a stall
 #define MAX_RENDER_DISTANCE 20.0f
 
-// Total display height including HUD and minimap
-#define TOTAL_DISPLAY_HEIGHT (SCREEN_HEIGHT + 15)
+// Total display height including HUD (3 lines), minimap (title + blank + map) and info (2 lines)
+#define TOTAL_DISPLAY_HEIGHT (SCREEN_HEIGHT + MAP_HEIGHT + 7)
 
 // Buffer size for a single line, accounting for characters + many color codes + null terminator
 #define MAX_ANSI_COLOR_CODE_LENGTH 10 // Max length of a typical color code like "\x1b[31m"
 #define TOTAL_LINE_BUFFER_SIZE (SCREEN_WIDTH + SCREEN_WIDTH * MAX_ANSI_COLOR_CODE_LENGTH + 1)
 
 // --- Map Definition ---
-char g_map[MAP_HEIGHT][MAP_WIDTH] = {
+// The current level occupies the top-left g_mapWidth x g_mapHeight cells
+char g_map[MAP_MAX_HEIGHT][MAP_MAX_WIDTH] = {
     "####################",
     "#........H.........#",
     "#..########....#...#",
     "#..#.......#...#E..#",
-    "#..#...D...#...#...#",
-    "#..#...#...#...#...#",
+    "#..#...D...#...:...#",
+    "#..#...#...#...:...#",
     "#..#.......#...#...#",
-    "#..########....#...#",
+    "#..###|||##....#...#",
     "#..................#",
-    "#....#######.......#",
+    "#....###D###.......#",
     "#....#.....#.......#",
     "#....#.....#.......#",
     "#....#.....#.......#",
     "#....#######.......#",
     "#..................#",
     "#........A.........#",
-    "#...########.......#",
-    "#...#......#.......#",
+    "#...##\"\"####.......#",
     "#...#......#.......#",
+    "#..@#.....@#.......#",
     "####################"
 };
+int g_mapWidth = MAP_WIDTH, g_mapHeight = MAP_HEIGHT;
+
+// Bars ('|'), fences (':') and windows ('"') stop movement like walls, but sight, sound and
+// shots pass through them and the raycaster draws what lies behind
+int isSeeThroughCell(char cell) {
+    return cell == '|' || cell == ':' || cell == '"';
+}
+
+int isSolidCell(char cell) {
+    return cell == '#' || isSeeThroughCell(cell);
+}
+
+// --- Map Triggers ---
+// Cells that run map logic when the player enters or leaves them, or interacts from or facing
+// them. Each acts on the target cell: plates hold a door open while stood on, switches toggle a
+// door, and spawn zones put an enemy at the target the first time they are entered.
+typedef enum {
+    TRIGGER_PLATE,
+    TRIGGER_SWITCH,
+    TRIGGER_SPAWN,
+} TriggerKind;
+
+typedef struct {
+    TriggerKind kind;
+    int mapX, mapY;
+    int targetX, targetY;
+} TriggerDef;
+
+const TriggerDef g_triggerDefs[] = {
+    { TRIGGER_PLATE, 8, 8, 7, 4 },   // Opens the small room's door from across the wall
+    { TRIGGER_SWITCH, 4, 12, 8, 9 }, // Opens the sealed room
+    { TRIGGER_SPAWN, 8, 10, 9, 12 }, // Ambush inside it
+};
+
+#define NUM_TRIGGERS (int)(sizeof(g_triggerDefs) / sizeof(g_triggerDefs[0]))
+#define MAX_TRIGGERS 64
+
+// Triggers of the current level; loaded levels bring none
+const TriggerDef* g_levelTriggers = g_triggerDefs;
+int g_numLevelTriggers = NUM_TRIGGERS;
+
+// --- Portal Cells ---
+// A portal cell ('@') is a window onto its target cell: a ray entering one face carries on
+// from the same point of the target's matching face, turned by `turns` quarter turns, and the
+// player walking in comes out there. The faces of the pair need not line up in the map.
+typedef struct {
+    int mapX, mapY;
+    int targetX, targetY;
+    int turns; // Quarter turns, clockwise on the minimap
+} PortalDef;
+
+const PortalDef g_portalDefs[] = {
+    { 3, 18, 5, 17, 0 },  // The left dead end looks into the walled-in bottom room
+    { 10, 18, 12, 18, 0 }, // and the room's far corner leads back out
+};
+
+// Portals of the current level; loaded levels bring none
+const PortalDef* g_levelPortals = g_portalDefs;
+int g_numLevelPortals = (int)(sizeof(g_portalDefs) / sizeof(g_portalDefs[0]));
+
+#define PORTAL_CELL '@'
+
+const PortalDef* findPortal(int mapX, int mapY) {
+    for (int i = 0; i < g_numLevelPortals; ++i) {
+        if (g_levelPortals[i].mapX == mapX && g_levelPortals[i].mapY == mapY) return &g_levelPortals[i];
+    }
+    return NULL;
+}
+
+// Turns a vector as `portal` does
+void turnThroughPortal(const PortalDef* portal, double* x, double* y) {
+    for (int i = 0; i < (portal->turns & 3); ++i) {
+        double oldX = *x;
+        *x = -*y;
+        *y = oldX;
+    }
+}
+
+// Moves a point in the portal cell to the matching point of the target cell
+void passThroughPortal(const PortalDef* portal, double* x, double* y) {
+    double localX = *x - (portal->mapX + 0.5), localY = *y - (portal->mapY + 0.5);
+    turnThroughPortal(portal, &localX, &localY);
+    *x = portal->targetX + 0.5 + localX;
+    *y = portal->targetY + 0.5 + localY;
+}
+
+// --- Sector Maps ---
+// An alternative world description: convex sectors bounded by line segments, where a segment
+// is either solid or a portal into the neighbouring sector. The renderer walks it front to
+// back through portals instead of stepping through grid cells. buildSectorMapFromGrid() derives
+// one from g_map by merging open cells into rectangles (each door gets its own sector, whose
+// panel is drawn inside it), so the same level renders either way; loadSegmentMap() reads one
+// from a text file. See-through and portal cells become plain walls here. Walls run around
+// each sector with its inside where cross(v1 - v0, p - v0) > 0.
+typedef struct {
+    float x, y;
+} MapVertex;
+
+typedef struct {
+    int v0, v1;
+    int portal;   // Sector on the other side, -1 = solid
+} SectorWall;
+
+typedef struct {
+    int firstWall, numWalls;
+    int doorX, doorY; // Grid door inside the sector, -1 = none
+} Sector;
+
+typedef struct {
+    MapVertex* vertices;
+    int numVertices;
+    SectorWall* walls;
+    int numWalls;
+    Sector* sectors;
+    int numSectors;
+    short cellSector[MAP_MAX_HEIGHT][MAP_MAX_WIDTH]; // Sector holding each cell, -1 = solid
+} SectorMap;
+
+SectorMap g_sectorMap;
+
+int addMapVertex(SectorMap* map, float x, float y) {
+    map->vertices[map->numVertices] = (MapVertex){ x, y };
+    return map->numVertices++;
+}
+
+int isSectorWall(char cell) {
+    return isSolidCell(cell) || cell == PORTAL_CELL;
+}
+
+// Returns 0 on success
+int buildSectorMapFromGrid(SectorMap* map) {
+    int cells = g_mapWidth * g_mapHeight;
+    map->sectors = malloc(sizeof(Sector) * cells);
+    map->walls = malloc(sizeof(SectorWall) * cells * 4);
+    map->vertices = malloc(sizeof(MapVertex) * cells * 8);
+    if (!map->sectors || !map->walls || !map->vertices) return -1;
+    map->numSectors = map->numWalls = map->numVertices = 0;
+    memset(map->cellSector, -1, sizeof(map->cellSector));
+
+    // Greedy rectangles: grow right, then down while the whole row is free
+    int* rectX0 = malloc(sizeof(int) * 4 * cells);
+    if (!rectX0) return -1;
+    int *rectY0 = rectX0 + cells, *rectX1 = rectY0 + cells, *rectY1 = rectX1 + cells;
+    for (int y = 0; y < g_mapHeight; ++y) {
+        for (int x = 0; x < g_mapWidth; ++x) {
+            if (isSectorWall(g_map[y][x]) || map->cellSector[y][x] >= 0) continue;
+            int isDoor = g_map[y][x] == 'D';
+            int x1 = x + 1, y1 = y + 1;
+            while (!isDoor && x1 < g_mapWidth && !isSectorWall(g_map[y][x1]) && g_map[y][x1] != 'D' && map->cellSector[y][x1] < 0) x1++;
+            for (int grow = !isDoor; grow && y1 < g_mapHeight; ) {
+                for (int cx = x; cx < x1; ++cx) {
+                    if (isSectorWall(g_map[y1][cx]) || g_map[y1][cx] == 'D' || map->cellSector[y1][cx] >= 0) grow = 0;
+                }
+                if (grow) y1++;
+            }
+            int id = map->numSectors++;
+            rectX0[id] = x; rectY0[id] = y; rectX1[id] = x1; rectY1[id] = y1;
+            map->sectors[id] = (Sector){ .doorX = isDoor ? x : -1, .doorY = isDoor ? y : -1 };
+            for (int cy = y; cy < y1; ++cy) {
+                for (int cx = x; cx < x1; ++cx) {
+                    map->cellSector[cy][cx] = (short)id;
+                }
+            }
+        }
+    }
+
+    // Walk each rectangle's edges a cell at a time, joining runs with the same neighbour
+    for (int id = 0; id < map->numSectors; ++id) {
+        Sector* sector = &map->sectors[id];
+        sector->firstWall = map->numWalls;
+        int x0 = rectX0[id], y0 = rectY0[id], x1 = rectX1[id], y1 = rectY1[id];
+        // Corners in order around the rectangle, and the step along each edge
+        int cornerX[4] = { x0, x1, x1, x0 }, cornerY[4] = { y0, y0, y1, y1 };
+        int alongX[4] = { 1, 0, -1, 0 }, alongY[4] = { 0, 1, 0, -1 };
+        for (int edge = 0; edge < 4; ++edge) {
+            int length = alongX[edge] ? x1 - x0 : y1 - y0;
+            int runStart = 0, runPortal = -2;
+            for (int i = 0; i <= length; ++i) {
+                int portal = -2; // Past the end: flushes the last run
+                if (i < length) {
+                    // Cell just outside unit i of the edge
+                    int cx = edge == 0 ? x0 + i : edge == 1 ? x1 : edge == 2 ? x1 - 1 - i : x0 - 1;
+                    int cy = edge == 0 ? y0 - 1 : edge == 1 ? y0 + i : edge == 2 ? y1 : y1 - 1 - i;
+                    portal = cx >= 0 && cx < g_mapWidth && cy >= 0 && cy < g_mapHeight ? map->cellSector[cy][cx] : -1;
+                }
+                if (portal != runPortal) {
+                    if (i > runStart) {
+                        int v0 = addMapVertex(map, cornerX[edge] + alongX[edge] * runStart, cornerY[edge] + alongY[edge] * runStart);
+                        int v1 = addMapVertex(map, cornerX[edge] + alongX[edge] * i, cornerY[edge] + alongY[edge] * i);
+                        map->walls[map->numWalls++] = (SectorWall){ v0, v1, runPortal };
+                    }
+                    runStart = i;
+                    runPortal = portal;
+                }
+            }
+        }
+        sector->numWalls = map->numWalls - sector->firstWall;
+    }
+    free(rectX0);
+    return 0;
+}
+
+int sectorContains(const SectorMap* map, int sectorIndex, float x, float y) {
+    const Sector* sector = &map->sectors[sectorIndex];
+    for (int w = 0; w < sector->numWalls; ++w) {
+        const MapVertex* a = &map->vertices[map->walls[sector->firstWall + w].v0];
+        const MapVertex* b = &map->vertices[map->walls[sector->firstWall + w].v1];
+        if ((b->x - a->x) * (y - a->y) - (b->y - a->y) * (x - a->x) < -1e-5f) return 0;
+    }
+    return 1;
+}
+
+// Sector holding (x, y), -1 if it is in solid space. The cell's sector is tried first, which
+// always holds the point in maps built from the grid.
+int findSector(const SectorMap* map, float x, float y) {
+    int cellX = (int)floorf(x), cellY = (int)floorf(y);
+    int hint = cellX >= 0 && cellX < MAP_MAX_WIDTH && cellY >= 0 && cellY < MAP_MAX_HEIGHT ? map->cellSector[cellY][cellX] : -1;
+    if (hint >= 0 && sectorContains(map, hint, x, y)) return hint;
+    for (int i = 0; i < map->numSectors; ++i) {
+        if (i != hint && sectorContains(map, i, x, y)) return i;
+    }
+    return -1;
+}
+
+void freeSectorMap(SectorMap* map) {
+    free(map->vertices);
+    free(map->walls);
+    free(map->sectors);
+    memset(map, 0, sizeof(*map));
+}
+
+// --- BSP Compiler ---
+// Binary space partition over a segment map's visible walls: solid walls and door panels (portals
+// are invisible and left out). Each node splits space along one segment's line and keeps the
+// segments lying on it; walking the near side first visits walls strictly front to back, which
+// lets the renderer stop as soon as every column is filled. Built once when a level loads.
+#define BSP_SPLIT_COST 8        // One split is worth this much front/back imbalance
+#define BSP_MAX_CANDIDATES 64   // Splitters scored per node; larger sets are sampled evenly
+#define BSP_EPSILON 1e-4f
+
+typedef struct {
+    MapVertex a, b;     // Solid walls face the side where cross(b - a, p - a) > 0
+    short doorX, doorY; // Door whose panel this is, -1 = solid wall
+} BspSeg;
+
+typedef struct {
+    MapVertex origin;   // Partition line: origin + t * dir; front is where cross(dir, p - origin) >= 0
+    float dirX, dirY;
+    int firstSeg, numSegs; // Segments on the line
+    int front, back;       // Child nodes, -1 = empty
+} BspNode;
+
+typedef struct {
+    BspSeg* segs;
+    int numSegs, segCapacity;
+    BspNode* nodes;
+    int numNodes, nodeCapacity;
+    int root;
+    int numSplits, depth; // Build statistics
+} BspTree;
+
+BspTree g_bspTree;
+
+// Whether the door at (x, y) has its panel spanning x: it runs between the walls it is set into
+int doorRunsAlongX(int x, int y) {
+    return (x > 0 && isSolidCell(g_map[y][x - 1])) || (x + 1 < g_mapWidth && isSolidCell(g_map[y][x + 1])) ||
+           !((y > 0 && isSolidCell(g_map[y - 1][x])) || (y + 1 < g_mapHeight && isSolidCell(g_map[y + 1][x])));
+}
+
+float bspSide(const BspNode* node, float x, float y) {
+    return node->dirX * (y - node->origin.y) - node->dirY * (x - node->origin.x);
+}
+
+int appendBspSeg(BspTree* tree, const BspSeg* seg) {
+    if (tree->numSegs == tree->segCapacity) {
+        int capacity = tree->segCapacity ? tree->segCapacity * 2 : 256;
+        BspSeg* segs = realloc(tree->segs, sizeof(BspSeg) * capacity);
+        if (!segs) return -1;
+        tree->segs = segs;
+        tree->segCapacity = capacity;
+    }
+    tree->segs[tree->numSegs++] = *seg;
+    return 0;
+}
+
+// Where `seg` lies against the line: 1 front, -1 back, 0 on it, 2 straddling
+int classifyBspSeg(const BspNode* line, const BspSeg* seg, float* side0, float* side1) {
+    float s0 = bspSide(line, seg->a.x, seg->a.y), s1 = bspSide(line, seg->b.x, seg->b.y);
+    *side0 = s0;
+    *side1 = s1;
+    if (fabsf(s0) < BSP_EPSILON && fabsf(s1) < BSP_EPSILON) return 0;
+    if (s0 > -BSP_EPSILON && s1 > -BSP_EPSILON) return 1;
+    if (s0 < BSP_EPSILON && s1 < BSP_EPSILON) return -1;
+    return 2;
+}
+
+BspNode bspLineOf(const BspSeg* seg) {
+    float dx = seg->b.x - seg->a.x, dy = seg->b.y - seg->a.y;
+    float length = sqrtf(dx * dx + dy * dy);
+    return (BspNode){ .origin = seg->a, .dirX = dx / length, .dirY = dy / length };
+}
+
+// Lower is better: splits cost extra segments, imbalance costs depth
+int scoreBspSplitter(const BspSeg* segs, int count, int candidate) {
+    BspNode line = bspLineOf(&segs[candidate]);
+    int front = 0, back = 0, splits = 0;
+    for (int i = 0; i < count; ++i) {
+        float s0, s1;
+        int where = classifyBspSeg(&line, &segs[i], &s0, &s1);
+        if (where == 1) front++;
+        else if (where == -1) back++;
+        else if (where == 2) splits++, front++, back++;
+    }
+    return splits * BSP_SPLIT_COST + abs(front - back);
+}
+
+// Builds a subtree from `segs` (consumed); returns its node index, -1 if empty or on failure
+int buildBspNode(BspTree* tree, BspSeg* segs, int count, int depth, int* failed) {
+    if (count == 0 || *failed) return -1;
+    if (depth > tree->depth) tree->depth = depth;
+
+    int best = 0, bestScore = 0x7fffffff;
+    int stride = count > BSP_MAX_CANDIDATES ? count / BSP_MAX_CANDIDATES : 1;
+    for (int i = 0; i < count; i += stride) {
+        int score = scoreBspSplitter(segs, count, i);
+        if (score < bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+
+    if (tree->numNodes == tree->nodeCapacity) {
+        int capacity = tree->nodeCapacity ? tree->nodeCapacity * 2 : 128;
+        BspNode* nodes = realloc(tree->nodes, sizeof(BspNode) * capacity);
+        if (!nodes) {
+            *failed = 1;
+            return -1;
+        }
+        tree->nodes = nodes;
+        tree->nodeCapacity = capacity;
+    }
+    int index = tree->numNodes++;
+    BspNode line = bspLineOf(&segs[best]);
+    line.firstSeg = tree->numSegs;
+
+    // Segments on the line stay here; the rest go to either side, cut where they straddle it
+    BspSeg* front = malloc(sizeof(BspSeg) * count * 2);
+    BspSeg* back = front ? front + count : NULL;
+    if (!front) {
+        *failed = 1;
+        return -1;
+    }
+    int numFront = 0, numBack = 0;
+    for (int i = 0; i < count; ++i) {
+        float s0, s1;
+        int where = classifyBspSeg(&line, &segs[i], &s0, &s1);
+        if (where == 0) {
+            if (appendBspSeg(tree, &segs[i]) != 0) *failed = 1;
+        } else if (where == 1) {
+            front[numFront++] = segs[i];
+        } else if (where == -1) {
+            back[numBack++] = segs[i];
+        } else {
+            float t = s0 / (s0 - s1);
+            MapVertex cut = { segs[i].a.x + t * (segs[i].b.x - segs[i].a.x), segs[i].a.y + t * (segs[i].b.y - segs[i].a.y) };
+            BspSeg first = segs[i], second = segs[i];
+            first.b = cut;
+            second.a = cut;
+            if (s0 > 0.0f) {
+                front[numFront++] = first;
+                back[numBack++] = second;
+            } else {
+                back[numBack++] = first;
+                front[numFront++] = second;
+            }
+            tree->numSplits++;
+        }
+    }
+    line.numSegs = tree->numSegs - line.firstSeg;
+    line.front = buildBspNode(tree, front, numFront, depth + 1, failed);
+    line.back = buildBspNode(tree, back, numBack, depth + 1, failed);
+    tree->nodes[index] = line;
+    free(front);
+    return index;
+}
+
+// Compiles the solid walls of `map`, plus a panel for every door sector. Returns 0 on success.
+int buildBspTree(BspTree* tree, const SectorMap* map) {
+    memset(tree, 0, sizeof(*tree));
+    BspSeg* segs = malloc(sizeof(BspSeg) * (map->numWalls + map->numSectors));
+    if (!segs) return -1;
+    int count = 0;
+    for (int i = 0; i < map->numWalls; ++i) {
+        if (map->walls[i].portal >= 0) continue;
+        segs[count++] = (BspSeg){ map->vertices[map->walls[i].v0], map->vertices[map->walls[i].v1], -1, -1 };
+    }
+    for (int i = 0; i < map->numSectors; ++i) {
+        int x = map->sectors[i].doorX, y = map->sectors[i].doorY;
+        if (x < 0) continue;
+        segs[count++] = doorRunsAlongX(x, y) ? (BspSeg){ { x, y + 0.5f }, { x + 1, y + 0.5f }, x, y }
+                                              : (BspSeg){ { x + 0.5f, y }, { x + 0.5f, y + 1 }, x, y };
+    }
+    int failed = 0;
+    tree->root = buildBspNode(tree, segs, count, 1, &failed);
+    free(segs);
+    return failed ? -1 : 0;
+}
+
+void freeBspTree(BspTree* tree) {
+    free(tree->segs);
+    free(tree->nodes);
+    memset(tree, 0, sizeof(*tree));
+}
 
 // --- Player State ---
 typedef struct {
@@ -80,403 +515,3091 @@ typedef struct {
     int health;
     int ammo;
     int score;
+    float velX, velY;   // Map units per second
+    float turnVel;      // Radians per second
+    float pitch;        // Horizon shift as a fraction of the view height, positive looks up
+    float eyeHeight;    // Eye above the floor in wall heights, easing toward the stance's
+    float jumpZ, velZ;  // Height of the current jump and its vertical speed
+    int crouched;
 } Player;
 
-Player g_player = { .x = 2.5f, .y = 2.5f, .angle = M_PI / 4.0f, .health = 100, .ammo = 10, .score = 0 };
+Player g_playerStart = { .x = 2.5f, .y = 2.5f, .angle = M_PI / 4.0f, .health = 100, .ammo = 10, .score = 0,
+                         .eyeHeight = PLAYER_EYE_HEIGHT };
+
+// Where the camera sits this tick, kept clear of the floor and ceiling
+float playerEyeHeight(const Player* p) {
+    float eye = p->eyeHeight + p->jumpZ;
+    return eye < 0.05f ? 0.05f : eye > 0.95f ? 0.95f : eye;
+}
+
+// --- WAD Import ---
+// Loads a level from a Doom-format WAD, mapped read-only. Each grid cell takes the sector
+// under its centre: outside the map or in a void it is a wall, in a closed sector (ceiling at
+// or below floor, which is how Doom stores a shut door) a door, otherwise open floor. Walls
+// and doors thinner than a cell are then stamped in along their linedefs so rooms don't leak
+// into each other, and THINGS become the player start, health, ammo and enemies.
+#define WAD_DEFAULT_CELL_SIZE 64 // Map units per cell; the player is 32 units wide
+#define WAD_THING_HMP 0x0002     // Present on "Hurt Me Plenty", the default skill
+#define WAD_THING_MULTIPLAYER 0x0010
+#define WAD_NO_SIDE 0xFFFF
+
+typedef struct {
+    const unsigned char* bytes;
+    size_t size;
+} WadFile;
+
+typedef struct {
+    const unsigned char* data;
+    int count; // Records of the lump's fixed size
+} WadLump;
+
+int readWadShort(const unsigned char* p) {
+    return (int16_t)(p[0] | p[1] << 8);
+}
+
+int readWadInt(const unsigned char* p) {
+    return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+// Returns 0 on success
+int mapWadFile(WadFile* wad, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    wad->size = size > 0 ? (size_t)size : 0;
+    wad->bytes = NULL;
+    if (wad->size > 0) {
+#ifdef _WIN32
+        unsigned char* bytes = malloc(wad->size);
+        fseek(file, 0, SEEK_SET);
+        if (bytes && fread(bytes, 1, wad->size, file) != wad->size) {
+            free(bytes);
+            bytes = NULL;
+        }
+        wad->bytes = bytes;
+#else
+        void* region = mmap(NULL, wad->size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        wad->bytes = region == MAP_FAILED ? NULL : region;
+#endif
+    }
+    fclose(file);
+    if (!wad->bytes) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void unmapWadFile(WadFile* wad) {
+#ifdef _WIN32
+    free((void*)wad->bytes);
+#else
+    if (wad->bytes) munmap((void*)wad->bytes, wad->size);
+#endif
+    wad->bytes = NULL;
+}
+
+// Finds lump `name` among the `window` lumps after directory entry `first`
+int findWadLump(const WadFile* wad, int first, int window, const char* name, int recordSize, WadLump* out) {
+    int numLumps = readWadInt(wad->bytes + 4), directory = readWadInt(wad->bytes + 8);
+    for (int i = first; i < first + window && i < numLumps; ++i) {
+        const unsigned char* entry = wad->bytes + directory + 16 * i;
+        if (strncmp((const char*)entry + 8, name, 8) != 0) continue;
+        int offset = readWadInt(entry), size = readWadInt(entry + 4);
+        if (offset < 0 || size < 0 || (size_t)offset + size > wad->size) break;
+        out->data = wad->bytes + offset;
+        out->count = size / recordSize;
+        return 0;
+    }
+    fprintf(stderr, "WAD map is missing its %s lump\n", name);
+    return -1;
+}
+
+// Sector on `side` (0 = right/front, 1 = left/back) of a linedef, -1 = nothing there
+int wadLineSector(WadLump lines, WadLump sides, WadLump sectors, int line, int side) {
+    int sideIndex = readWadShort(lines.data + 14 * line + 10 + 2 * side) & 0xFFFF;
+    if (sideIndex == WAD_NO_SIDE || sideIndex >= sides.count) return -1;
+    int sector = readWadShort(sides.data + 30 * sideIndex + 28);
+    return sector >= 0 && sector < sectors.count ? sector : -1;
+}
+
+int wadSectorClosed(WadLump sectors, int sector) {
+    const unsigned char* record = sectors.data + 26 * sector;
+    return readWadShort(record + 2) <= readWadShort(record);
+}
+
+// Sector containing (x, y): the nearest linedef crossed going +x, on the side facing the point
+int wadSectorAt(WadLump vertices, WadLump lines, WadLump sides, WadLump sectors, float x, float y) {
+    float nearest = 1e30f;
+    int sector = -1;
+    for (int i = 0; i < lines.count; ++i) {
+        const unsigned char* line = lines.data + 14 * i;
+        int v0 = readWadShort(line) & 0xFFFF, v1 = readWadShort(line + 2) & 0xFFFF;
+        if (v0 >= vertices.count || v1 >= vertices.count) continue;
+        float x0 = readWadShort(vertices.data + 4 * v0), y0 = readWadShort(vertices.data + 4 * v0 + 2);
+        float x1 = readWadShort(vertices.data + 4 * v1), y1 = readWadShort(vertices.data + 4 * v1 + 2);
+        if ((y0 > y) == (y1 > y)) continue;
+        float crossX = x0 + (y - y0) * (x1 - x0) / (y1 - y0);
+        if (crossX < x || crossX >= nearest) continue;
+        nearest = crossX;
+        int onLeft = (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0) > 0.0f; // Map y points up
+        sector = wadLineSector(lines, sides, sectors, i, onLeft);
+    }
+    return sector;
+}
+
+// Sessions initialised and not yet freed; the level is shared by all
+#ifdef _WIN32
+int g_liveSessions;
+#else
+atomic_int g_liveSessions; // ++, -- and reads are atomic
+#endif
+
+// Checks the level in g_map, loaded from `path`, against what a session holds: objects past
+// the cap are left out, and doors past it become walls (a 'D' cell without a door is open)
+void fitLevelToSession(const char* path) {
+    int objects = 0, doors = 0;
+    for (int y = 0; y < g_mapHeight; ++y) {
+        for (int x = 0; x < g_mapWidth; ++x) {
+            objects += g_map[y][x] == 'H' || g_map[y][x] == 'A' || g_map[y][x] == 'E';
+            if (g_map[y][x] == 'D' && ++doors > MAX_DOORS) g_map[y][x] = '#';
+        }
+    }
+    if (objects > MAX_GAME_OBJECTS) {
+        fprintf(stderr, "Warning: %s places %d objects; only the first %d are kept\n", path, objects, MAX_GAME_OBJECTS);
+    }
+    if (doors > MAX_DOORS) {
+        fprintf(stderr, "Warning: %s has %d door cells; past the first %d they are walls\n", path, doors, MAX_DOORS);
+    }
+}
+
+// Replaces g_map with map `mapName` (e.g. "E1M1", NULL = the first) of the WAD at `path`,
+// `cellSize` map units to a cell. Returns 0 on success; the current level stays on failure.
+// Sessions index the level's tables, so it is refused while any session exists.
+int loadWadMap(const char* path, const char* mapName, int cellSize) {
+    if (g_liveSessions > 0) {
+        fprintf(stderr, "Cannot load %s while game sessions exist\n", path);
+        return -1;
+    }
+    WadFile wad;
+    if (mapWadFile(&wad, path) != 0) return -1;
+    int result = -1;
+    int numLumps = wad.size >= 12 ? readWadInt(wad.bytes + 4) : -1;
+    int directory = wad.size >= 12 ? readWadInt(wad.bytes + 8) : -1;
+    if (numLumps < 0 || directory < 0 || (size_t)directory + 16 * (size_t)numLumps > wad.size ||
+        (memcmp(wad.bytes, "IWAD", 4) != 0 && memcmp(wad.bytes, "PWAD", 4) != 0)) {
+        fprintf(stderr, "%s is not a WAD file\n", path);
+        unmapWadFile(&wad);
+        return -1;
+    }
+
+    // A map is a marker lump followed by its data lumps
+    int marker = -1;
+    for (int i = 0; i + 1 < numLumps && marker < 0; ++i) {
+        const unsigned char* entry = wad.bytes + directory + 16 * i;
+        if (mapName ? strncmp((const char*)entry + 8, mapName, 8) == 0 : strncmp((const char*)entry + 24, "THINGS", 8) == 0) marker = i;
+    }
+    WadLump things, lines, sides, vertices, sectors;
+    if (marker < 0) {
+        fprintf(stderr, "%s has no map %s\n", path, mapName ? mapName : "");
+    } else if (findWadLump(&wad, marker + 1, 10, "THINGS", 10, &things) == 0 &&
+               findWadLump(&wad, marker + 1, 10, "LINEDEFS", 14, &lines) == 0 &&
+               findWadLump(&wad, marker + 1, 10, "SIDEDEFS", 30, &sides) == 0 &&
+               findWadLump(&wad, marker + 1, 10, "VERTEXES", 4, &vertices) == 0 &&
+               findWadLump(&wad, marker + 1, 10, "SECTORS", 26, &sectors) == 0) {
+        int minX = 0x7fff, minY = 0x7fff, maxX = -0x8000, maxY = -0x8000;
+        for (int i = 0; i < vertices.count; ++i) {
+            int x = readWadShort(vertices.data + 4 * i), y = readWadShort(vertices.data + 4 * i + 2);
+            if (x < minX) minX = x;
+            if (x > maxX) maxX = x;
+            if (y < minY) minY = y;
+            if (y > maxY) maxY = y;
+        }
+        // One cell of wall around the level
+        int width = vertices.count ? (maxX - minX + cellSize - 1) / cellSize + 2 : 0;
+        int height = vertices.count ? (maxY - minY + cellSize - 1) / cellSize + 2 : 0;
+        if (width < 3 || height < 3) {
+            fprintf(stderr, "WAD map has no geometry\n");
+        } else if (width > MAP_MAX_WIDTH || height > MAP_MAX_HEIGHT) {
+            fprintf(stderr, "WAD map is %dx%d cells at %d units per cell; at most %dx%d fit\n",
+                    width, height, cellSize, MAP_MAX_WIDTH, MAP_MAX_HEIGHT);
+        } else {
+            result = 0;
+        }
+        // Kept to put back if the level turns out to be unplayable
+        char (*savedMap)[MAP_MAX_WIDTH] = result == 0 ? malloc(sizeof(g_map)) : NULL;
+        int savedWidth = g_mapWidth, savedHeight = g_mapHeight;
+        Player savedStart = g_playerStart;
+        if (result == 0 && !savedMap) {
+            fprintf(stderr, "Out of memory loading %s\n", path);
+            result = -1;
+        }
+        if (result == 0) {
+            memcpy(savedMap, g_map, sizeof(g_map));
+            memset(g_map, '#', sizeof(g_map));
+            g_mapWidth = width;
+            g_mapHeight = height;
+            for (int y = 1; y < height - 1; ++y) {
+                for (int x = 1; x < width - 1; ++x) {
+                    float centerX = minX + (x - 0.5f) * cellSize, centerY = maxY - (y - 0.5f) * cellSize;
+                    int sector = wadSectorAt(vertices, lines, sides, sectors, centerX, centerY);
+                    g_map[y][x] = sector < 0 ? '#' : wadSectorClosed(sectors, sector) ? 'D' : '.';
+                }
+            }
+
+            // Stamp thin walls half a cell into their void side, and door faces just inside the door
+            for (int i = 0; i < lines.count; ++i) {
+                const unsigned char* line = lines.data + 14 * i;
+                int v0 = readWadShort(line) & 0xFFFF, v1 = readWadShort(line + 2) & 0xFFFF;
+                if (v0 >= vertices.count || v1 >= vertices.count) continue;
+                int front = wadLineSector(lines, sides, sectors, i, 0), back = wadLineSector(lines, sides, sectors, i, 1);
+                int frontClosed = front >= 0 && wadSectorClosed(sectors, front);
+                int backClosed = back >= 0 && wadSectorClosed(sectors, back);
+                char stamp;
+                float push; // Along the left normal, in map units
+                if (front >= 0 && back < 0) {
+                    stamp = '#';
+                    push = cellSize * 0.5f;
+                } else if (front >= 0 && back >= 0 && frontClosed != backClosed) {
+                    stamp = 'D';
+                    push = backClosed ? 0.5f : -0.5f;
+                } else {
+                    continue;
+                }
+                float x0 = readWadShort(vertices.data + 4 * v0), y0 = readWadShort(vertices.data + 4 * v0 + 2);
+                float x1 = readWadShort(vertices.data + 4 * v1), y1 = readWadShort(vertices.data + 4 * v1 + 2);
+                float length = sqrtf((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+                if (length <= 0.0f) continue;
+                float normalX = -(y1 - y0) / length * push, normalY = (x1 - x0) / length * push;
+                // Samples stay off the endpoints, which sit on cell corners in grid-aligned maps
+                int steps = (int)(length * 4.0f / cellSize) + 1;
+                for (int s = 0; s < steps; ++s) {
+                    float along = (s + 0.5f) / steps;
+                    float wx = x0 + (x1 - x0) * along + normalX, wy = y0 + (y1 - y0) * along + normalY;
+                    int x = (int)floorf((wx - minX) / cellSize) + 1, y = (int)floorf((maxY - wy) / cellSize) + 1;
+                    if (x < 1 || x >= width - 1 || y < 1 || y >= height - 1) continue;
+                    if (stamp == 'D' || g_map[y][x] == '.') g_map[y][x] = stamp;
+                }
+            }
+
+            g_playerStart.x = g_playerStart.y = -1.0f; // A map without a player 1 start is rejected below
+            for (int i = 0; i < things.count; ++i) {
+                const unsigned char* thing = things.data + 10 * i;
+                int type = readWadShort(thing + 6), flags = readWadShort(thing + 8);
+                float cellX = (readWadShort(thing) - minX) / (float)cellSize + 1.0f;
+                float cellY = (maxY - readWadShort(thing + 2)) / (float)cellSize + 1.0f;
+                if (type == 1) {
+                    g_playerStart.x = cellX;
+                    g_playerStart.y = cellY;
+                    g_playerStart.angle = M_PI / 2.0 + readWadShort(thing + 4) * M_PI / 180.0; // Doom: 0 = east, counter-clockwise
+                    continue;
+                }
+                if (!(flags & WAD_THING_HMP) || (flags & WAD_THING_MULTIPLAYER)) continue;
+                char mapChar = 0;
+                switch (type) {
+                    case 2011: case 2012: case 2013: case 2014: // Stimpack, medikit, soulsphere, bonus
+                        mapChar = 'H';
+                        break;
+                    case 2007: case 2008: case 2010: case 2046: case 2047: case 2048: case 2049: case 17: case 8:
+                        mapChar = 'A'; // Clips, shells, rockets, cells and their boxes, backpack
+                        break;
+                    case 3001: case 3002: case 3003: case 3004: case 3005: case 3006: case 9: case 58: case 16:
+                    case 7: case 64: case 65: case 66: case 67: case 68: case 69: case 71: case 84:
+                        mapChar = 'E'; // Every monster plays as an imp here
+                        break;
+                }
+                int x = (int)cellX, y = (int)cellY;
+                if (mapChar && x > 0 && x < width - 1 && y > 0 && y < height - 1 && g_map[y][x] == '.') g_map[y][x] = mapChar;
+            }
+            float startX = g_playerStart.x, startY = g_playerStart.y;
+            if (!(startX >= 1.0f && startX < width - 1 && startY >= 1.0f && startY < height - 1) ||
+                isSolidCell(g_map[(int)startY][(int)startX]) || g_map[(int)startY][(int)startX] == 'D') {
+                fprintf(stderr, "WAD map has no player start on open floor at %d units per cell\n", cellSize);
+                memcpy(g_map, savedMap, sizeof(g_map));
+                g_mapWidth = savedWidth;
+                g_mapHeight = savedHeight;
+                g_playerStart = savedStart;
+                result = -1;
+            } else {
+                g_levelTriggers = NULL; // Trigger and portal tables are written for the built-in level
+                g_numLevelTriggers = 0;
+                g_levelPortals = NULL;
+                g_numLevelPortals = 0;
+                fitLevelToSession(path);
+            }
+        }
+        free(savedMap);
+    }
+    unmapWadFile(&wad);
+    return result;
+}
+
+// --- Segment Map Files ---
+// A level given directly as convex sectors (--segments FILE), in grid units with y growing
+// down, one statement per line and '#' starting a comment:
+//     v X Y                a vertex
+//     s V0 V1 V2 ...       a convex sector through these vertices (0-based), either way round
+//     start X Y DEGREES    the player start; 0 faces +y and 90 faces +x
+//     thing H|A|E X Y      health, ammo or a monster
+// An edge two sectors both list (the same two vertices) is a portal between them, any other
+// edge a solid wall. The renderers draw the segments themselves; gameplay still runs on the
+// grid, where each cell takes the sector under its centre, as WAD levels do.
+#define SEGMENT_MAP_MAX_LINE 1024
+
+// Reads the sector loop on `line` into `walls` (winding it so the inside is on the left),
+// returns the wall count or -1 if it is not a convex polygon
+int parseSegmentSector(const char* line, const MapVertex* vertices, int numVertices, SectorWall* walls, int maxWalls) {
+    int count = 0, index, used;
+    while (count < maxWalls && sscanf(line, "%d%n", &index, &used) == 1) {
+        if (index < 0 || index >= numVertices) return -1;
+        walls[count++] = (SectorWall){ .v0 = index, .portal = -1 };
+        line += used;
+    }
+    if (count < 3) return -1;
+    double area = 0.0;
+    for (int i = 0; i < count; ++i) {
+        walls[i].v1 = walls[(i + 1) % count].v0;
+        const MapVertex *a = &vertices[walls[i].v0], *b = &vertices[walls[i].v1];
+        if (a->x == b->x && a->y == b->y) return -1;
+        area += a->x * b->y - b->x * a->y;
+    }
+    if (fabs(area) < 1e-9) return -1;
+    if (area < 0.0) {
+        for (int i = 0; i < count / 2; ++i) {
+            SectorWall swap = walls[i];
+            walls[i] = walls[count - 1 - i];
+            walls[count - 1 - i] = swap;
+        }
+        for (int i = 0; i < count; ++i) {
+            int v0 = walls[i].v0;
+            walls[i].v0 = walls[i].v1;
+            walls[i].v1 = v0;
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        const MapVertex *a = &vertices[walls[i].v0], *b = &vertices[walls[i].v1];
+        const MapVertex* c = &vertices[walls[(i + 1) % count].v1];
+        if ((b->x - a->x) * (c->y - b->y) - (b->y - a->y) * (c->x - b->x) < -1e-6f) return -1;
+    }
+    return count;
+}
+
+// Reads the level at `path` into `map` and replaces g_map and the player start with its grid.
+// Returns 0 on success; like loadWadMap() it keeps the current level on failure and is refused
+// while sessions exist.
+int loadSegmentMap(SectorMap* map, const char* path) {
+    if (g_liveSessions > 0) {
+        fprintf(stderr, "Cannot load %s while game sessions exist\n", path);
+        return -1;
+    }
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open segment map %s\n", path);
+        return -1;
+    }
+
+    // First pass sizes the tables: every number on an "s" line is one wall
+    char line[SEGMENT_MAP_MAX_LINE];
+    int maxVertices = 0, maxSectors = 0, maxWalls = 0;
+    while (fgets(line, sizeof(line), f)) {
+        const char* c = line + strspn(line, " \t");
+        if (*c == 'v') maxVertices++;
+        if (*c == 's') {
+            maxSectors++;
+            for (; *c; ++c) maxWalls += *c >= '0' && *c <= '9' && !(c[1] >= '0' && c[1] <= '9');
+        }
+    }
+    SectorMap loaded = { 0 };
+    loaded.vertices = malloc(sizeof(MapVertex) * (maxVertices + 1));
+    loaded.sectors = malloc(sizeof(Sector) * (maxSectors + 1));
+    loaded.walls = malloc(sizeof(SectorWall) * (maxWalls + 1));
+    char (*grid)[MAP_MAX_WIDTH] = malloc(sizeof(g_map));
+    int result = loaded.vertices && loaded.sectors && loaded.walls && grid ? 0 : -1;
+    if (result != 0) fprintf(stderr, "Out of memory loading %s\n", path);
+
+    Player start = g_playerStart;
+    start.x = start.y = -1.0f;
+    float maxX = 0.0f, maxY = 0.0f;
+    memset(grid, '#', sizeof(g_map));
+    rewind(f);
+    for (int lineNumber = 1; result == 0 && fgets(line, sizeof(line), f); ++lineNumber) {
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char kind[8] = "", glyph = 0;
+        float x, y, degrees;
+        int used = 0;
+        if (sscanf(line, "%7s%n", kind, &used) != 1) continue;
+        if (strcmp(kind, "v") == 0 && sscanf(line + used, "%f %f", &x, &y) == 2 && x >= 0.0f && y >= 0.0f) {
+            loaded.vertices[loaded.numVertices++] = (MapVertex){ x, y };
+            if (x > maxX) maxX = x;
+            if (y > maxY) maxY = y;
+        } else if (strcmp(kind, "s") == 0) {
+            int count = parseSegmentSector(line + used, loaded.vertices, loaded.numVertices,
+                                           loaded.walls + loaded.numWalls, maxWalls - loaded.numWalls);
+            if (count < 0) {
+                fprintf(stderr, "%s:%d: expected a convex sector of at least 3 defined vertices\n", path, lineNumber);
+                result = -1;
+                break;
+            }
+            loaded.sectors[loaded.numSectors++] = (Sector){ loaded.numWalls, count, -1, -1 };
+            loaded.numWalls += count;
+        } else if (strcmp(kind, "start") == 0 && sscanf(line + used, "%f %f %f", &x, &y, &degrees) == 3) {
+            start.x = x;
+            start.y = y;
+            start.angle = degrees * M_PI / 180.0;
+        } else if (strcmp(kind, "thing") == 0 && sscanf(line + used, " %c %f %f", &glyph, &x, &y) == 3 && strchr("HAE", glyph)) {
+            if (x >= 0.0f && x < MAP_MAX_WIDTH && y >= 0.0f && y < MAP_MAX_HEIGHT) grid[(int)y][(int)x] = glyph; // Kept if open below
+        } else {
+            fprintf(stderr, "%s:%d: cannot read '%s'\n", path, lineNumber, kind);
+            result = -1;
+        }
+    }
+    fclose(f);
+
+    // A one-cell wall border around the vertices' extent
+    int width = (int)ceilf(maxX) + 1, height = (int)ceilf(maxY) + 1;
+    if (result == 0 && (loaded.numSectors == 0 || width > MAP_MAX_WIDTH || height > MAP_MAX_HEIGHT)) {
+        fprintf(stderr, "%s: needs at least one sector, within %dx%d cells\n", path, MAP_MAX_WIDTH - 1, MAP_MAX_HEIGHT - 1);
+        result = -1;
+    }
+    if (result == 0) {
+        // Edges listed by two sectors join them
+        for (int i = 0; i < loaded.numSectors; ++i) {
+            for (int w = loaded.sectors[i].firstWall; w < loaded.sectors[i].firstWall + loaded.sectors[i].numWalls; ++w) {
+                for (int other = i + 1; other < loaded.numSectors; ++other) {
+                    const Sector* next = &loaded.sectors[other];
+                    for (int o = next->firstWall; o < next->firstWall + next->numWalls; ++o) {
+                        if (loaded.walls[o].v0 == loaded.walls[w].v1 && loaded.walls[o].v1 == loaded.walls[w].v0) {
+                            loaded.walls[w].portal = other;
+                            loaded.walls[o].portal = i;
+                        }
+                    }
+                }
+            }
+        }
+        memset(loaded.cellSector, -1, sizeof(loaded.cellSector));
+        for (int y = 1; y < height - 1; ++y) {
+            for (int x = 1; x < width - 1; ++x) {
+                int sector = findSector(&loaded, x + 0.5f, y + 0.5f);
+                loaded.cellSector[y][x] = (short)sector;
+                if (sector < 0) grid[y][x] = '#';
+                else if (grid[y][x] == '#') grid[y][x] = '.';
+            }
+        }
+        for (int y = 0; y < MAP_MAX_HEIGHT; ++y) {
+            for (int x = 0; x < MAP_MAX_WIDTH; ++x) {
+                if (x == 0 || y == 0 || x >= width - 1 || y >= height - 1) grid[y][x] = '#';
+            }
+        }
+        if (!(start.x >= 1.0f && start.x < width - 1 && start.y >= 1.0f && start.y < height - 1) ||
+            grid[(int)start.y][(int)start.x] == '#') {
+            fprintf(stderr, "%s: needs a start on open floor\n", path);
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        memcpy(g_map, grid, sizeof(g_map));
+        g_mapWidth = width;
+        g_mapHeight = height;
+        g_playerStart = start;
+        g_levelTriggers = NULL; // Trigger and portal tables are written for the built-in level
+        g_numLevelTriggers = 0;
+        g_levelPortals = NULL;
+        g_numLevelPortals = 0;
+        fitLevelToSession(path);
+        freeSectorMap(map);
+        *map = loaded;
+    } else {
+        freeSectorMap(&loaded);
+    }
+    free(grid);
+    return result;
+}
+
+// --- Sprite Art ---
+// Each sprite has one piece of art per level of detail. The level is picked from the
+// projected height, so a distant sprite costs a single cell no matter how many are on the map.
+// Spaces are transparent.
+typedef enum {
+    SPRITE_LOD_DETAIL,  // Full multi-glyph art up close
+    SPRITE_LOD_SIMPLE,  // Small silhouette at mid range
+    SPRITE_LOD_MARKER,  // Single glyph (the object's displayChar) far away
+    SPRITE_LOD_COUNT
+} SpriteLod;
+
+#define SPRITE_LOD_DETAIL_MIN_HEIGHT 8 // Projected rows needed before detailed art pays off
+#define SPRITE_LOD_SIMPLE_MIN_HEIGHT 3
+
+typedef enum {
+    SPRITE_IMP,
+    SPRITE_MEDKIT,
+    SPRITE_AMMO_BOX,
+    SPRITE_PLASMA,    // Projectile
+    NUM_SPRITES
+} SpriteId;
+
+// Art can have several facings, indexed by the direction the sprite faces as seen by the
+// viewer: 0 = toward the viewer, then clockwise on screen (1 = facing right, 2 = away, ...).
+#define MAX_SPRITE_FACINGS 4
+#define MAX_SPRITE_ART_ROWS 8
+
+typedef struct {
+    int width, height;
+    const char* rows[MAX_SPRITE_ART_ROWS];
+    int mirrored; // Built by mirroring facing (numFacings - index) left to right
+} SpriteArt;
+
+typedef struct {
+    int numFacings;
+    SpriteArt art[SPRITE_LOD_MARKER][MAX_SPRITE_FACINGS];
+} SpriteDef;
+
+const SpriteDef g_spriteDefs[NUM_SPRITES] = {
+    [SPRITE_IMP] = { 4, {
+        [SPRITE_LOD_DETAIL] = {
+            { 8, 8, { "  /MM\\  ",
+                      " ( oo ) ",
+                      "  \\--/  ",
+                      " /|##|\\ ",
+                      "/ |##| \\",
+                      "  |  |  ",
+                      "  /  \\  ",
+                      " _|  |_ " } },
+            { 8, 8, { "  /MM\\  ",
+                      "  (  o) ",
+                      "   \\_>  ",
+                      "  |##|- ",
+                      "  |##|  ",
+                      "  |  |  ",
+                      "  |  \\  ",
+                      "  |_  \\_" } },
+            { 8, 8, { "  /MM\\  ",
+                      " (    ) ",
+                      "  \\__/  ",
+                      " /|##|\\ ",
+                      "/ |##| \\",
+                      "  |  |  ",
+                      "  /  \\  ",
+                      " _|  |_ " } },
+            { .mirrored = 1 },
+        },
+        [SPRITE_LOD_SIMPLE] = {
+            { 3, 4, { "(M)",
+                      "/#\\",
+                      " # ",
+                      "/ \\" } },
+            { 3, 4, { " M>",
+                      " #\\",
+                      " # ",
+                      " |\\" } },
+            { 3, 4, { "( )",
+                      "/#\\",
+                      " # ",
+                      "/ \\" } },
+            { .mirrored = 1 },
+        },
+    } },
+    [SPRITE_MEDKIT] = { 1, {
+        [SPRITE_LOD_DETAIL] = {
+            { 6, 5, { ".----.",
+                      "| ++ |",
+                      "|++++|",
+                      "| ++ |",
+                      "'----'" } },
+        },
+        [SPRITE_LOD_SIMPLE] = {
+            { 3, 3, { "+-+",
+                      "|+|",
+                      "+-+" } },
+        },
+    } },
+    [SPRITE_AMMO_BOX] = { 1, {
+        [SPRITE_LOD_DETAIL] = {
+            { 7, 4, { " _ _ _ ",
+                      "| | | |",
+                      "|!|!|!|",
+                      "|_|_|_|" } },
+        },
+        [SPRITE_LOD_SIMPLE] = {
+            { 3, 2, { "!!!",
+                      "|||" } },
+        },
+    } },
+    [SPRITE_PLASMA] = { 1, {
+        [SPRITE_LOD_DETAIL] = {
+            { 3, 3, { " * ",
+                      "*@*",
+                      " * " } },
+        },
+        [SPRITE_LOD_SIMPLE] = {
+            { 1, 1, { "@" } },
+        },
+    } },
+};
+
+// --- Sprite Atlas ---
+// All art is packed once into a single glyph sheet. Every (sprite, lod, facing) is a frame.
+#define SPRITE_ATLAS_SIZE 4096
+#define NUM_SPRITE_FRAMES (NUM_SPRITES * SPRITE_LOD_MARKER * MAX_SPRITE_FACINGS)
+
+typedef struct {
+    int offset;         // Row-major start in the atlas pixels
+    int width, height;
+} AtlasFrame;
+
+typedef struct {
+    char pixels[SPRITE_ATLAS_SIZE];
+    int used;
+    AtlasFrame frames[NUM_SPRITE_FRAMES];
+} SpriteAtlas;
+
+SpriteAtlas g_spriteAtlas;
+
+int spriteFrameId(SpriteId sprite, SpriteLod lod, int facing) {
+    return (sprite * SPRITE_LOD_MARKER + lod) * MAX_SPRITE_FACINGS + facing;
+}
+
+char mirrorGlyph(char c) {
+    switch (c) {
+        case '/': return '\\';
+        case '\\': return '/';
+        case '(': return ')';
+        case ')': return '(';
+        case '<': return '>';
+        case '>': return '<';
+        case '[': return ']';
+        case ']': return '[';
+        default: return c;
+    }
+}
+
+// Returns -1 if the art does not fit in SPRITE_ATLAS_SIZE
+int buildSpriteAtlas() {
+    g_spriteAtlas.used = 0;
+    for (int sprite = 0; sprite < NUM_SPRITES; ++sprite) {
+        const SpriteDef* def = &g_spriteDefs[sprite];
+        for (int lod = 0; lod < SPRITE_LOD_MARKER; ++lod) {
+            for (int facing = 0; facing < def->numFacings; ++facing) {
+                const SpriteArt* art = &def->art[lod][facing];
+                int mirror = art->mirrored;
+                if (mirror) art = &def->art[lod][def->numFacings - facing];
+
+                AtlasFrame* frame = &g_spriteAtlas.frames[spriteFrameId(sprite, lod, facing)];
+                if (g_spriteAtlas.used + art->width * art->height > SPRITE_ATLAS_SIZE) {
+                    fprintf(stderr, "Sprite atlas overflow; raise SPRITE_ATLAS_SIZE\n");
+                    return -1;
+                }
+                frame->offset = g_spriteAtlas.used;
+                frame->width = art->width;
+                frame->height = art->height;
+                g_spriteAtlas.used += art->width * art->height;
+                for (int y = 0; y < art->height; ++y) {
+                    for (int x = 0; x < art->width; ++x) {
+                        char* dst = &g_spriteAtlas.pixels[frame->offset + y * art->width + x];
+                        *dst = mirror ? mirrorGlyph(art->rows[y][art->width - 1 - x]) : art->rows[y][x];
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+SpriteLod selectSpriteLod(int projectedHeight) {
+    if (projectedHeight >= SPRITE_LOD_DETAIL_MIN_HEIGHT) return SPRITE_LOD_DETAIL;
+    if (projectedHeight >= SPRITE_LOD_SIMPLE_MIN_HEIGHT) return SPRITE_LOD_SIMPLE;
+    return SPRITE_LOD_MARKER;
+}
+
+// Picks the facing from the object's heading and the line of sight to it
+int selectSpriteFacing(int numFacings, float heading, double losX, double losY) {
+    if (numFacings <= 1) return 0;
+    double headX = sin(heading), headY = cos(heading);
+    double towardViewer = -(headX * losX + headY * losY);
+    double towardRight = headX * losY - headY * losX; // Screen-right of the line of sight
+    double sector = atan2(towardRight, towardViewer) / (2.0 * M_PI) * numFacings;
+    int facing = (int)floor(sector + 0.5);
+    return ((facing % numFacings) + numFacings) % numFacings;
+}
+
+// Width of a scaled frame: the usual aspect approximation, but never squeezing art below
+// its own width while there are enough rows to show it
+int scaledSpriteWidth(const AtlasFrame* frame, int height) {
+    int width = (int)(height * 0.75);
+    int minWidth = frame->width < height ? frame->width : height;
+    return width > minWidth ? width : (minWidth > 0 ? minWidth : 1);
+}
+
+// --- Scaled Sprite Cache ---
+// Frames pre-scaled to an integer height and stored column-major, so drawing a sprite column
+// is a straight copy. Slots are fixed-size, which bounds the memory, and the least recently
+// used slot is evicted on a miss. Taller sprites (very close) are sampled from the atlas.
+// Each thread has its own cache, so sessions can render in parallel; a zeroed cache is empty.
+#define SPRITE_CACHE_MAX_HEIGHT (2 * SCREEN_HEIGHT)
+#define SPRITE_CACHE_SLOTS 48
+#define SPRITE_CACHE_SLOT_BYTES (SPRITE_CACHE_MAX_HEIGHT * SPRITE_CACHE_MAX_HEIGHT)
+
+typedef struct {
+    int frameId;
+    int height, width;
+    unsigned long lastUse; // 0 when free
+} ScaledSpriteSlot;
+
+typedef struct {
+    ScaledSpriteSlot slots[SPRITE_CACHE_SLOTS];
+    char data[SPRITE_CACHE_SLOTS][SPRITE_CACHE_SLOT_BYTES];
+    short index[NUM_SPRITE_FRAMES][SPRITE_CACHE_MAX_HEIGHT + 1]; // Slot + 1, 0 = none
+    unsigned long clock;
+} SpriteCache;
+
+_Thread_local SpriteCache g_spriteCache;
+
+// Returns the column-major glyphs of `frameId` scaled to `height` rows, or NULL if too tall
+const char* getScaledSprite(int frameId, int height, int* widthOut) {
+    if (height > SPRITE_CACHE_MAX_HEIGHT) return NULL;
+
+    SpriteCache* cache = &g_spriteCache;
+    int slotIndex = cache->index[frameId][height] - 1;
+    if (slotIndex < 0) {
+        // Miss: take a free slot or evict the least recently used one
+        slotIndex = 0;
+        for (int i = 0; i < SPRITE_CACHE_SLOTS; ++i) {
+            if (cache->slots[i].lastUse == 0) {
+                slotIndex = i;
+                break;
+            }
+            if (cache->slots[i].lastUse < cache->slots[slotIndex].lastUse) slotIndex = i;
+        }
+        ScaledSpriteSlot* slot = &cache->slots[slotIndex];
+        if (slot->lastUse != 0) cache->index[slot->frameId][slot->height] = 0;
+
+        const AtlasFrame* frame = &g_spriteAtlas.frames[frameId];
+        const char* src = g_spriteAtlas.pixels + frame->offset;
+        char* dst = cache->data[slotIndex];
+        slot->frameId = frameId;
+        slot->height = height;
+        slot->width = scaledSpriteWidth(frame, height);
+        for (int x = 0; x < slot->width; ++x) {
+            int texX = x * frame->width / slot->width;
+            for (int y = 0; y < height; ++y) {
+                *dst++ = src[(y * frame->height / height) * frame->width + texX];
+            }
+        }
+        cache->index[frameId][height] = (short)(slotIndex + 1);
+    }
+
+    ScaledSpriteSlot* slot = &cache->slots[slotIndex];
+    slot->lastUse = ++cache->clock;
+    *widthOut = slot->width;
+    return cache->data[slotIndex];
+}
+
+// --- Game Object Structure ---
+typedef enum {
+    OBJ_HEALTH,
+    OBJ_AMMO,
+    OBJ_ENEMY,
+} ObjectType;
+
+typedef struct {
+    float x, y;
+    char displayChar;
+    const char* color; // This is not strictly used in the new rendering, `color` in g_colorBuffer is
+    ObjectType type;
+    int active;
+    int health;
+    SpriteId sprite;
+    float heading; // Direction the object faces, same convention as the player angle
+    // Enemy AI
+    int aiState;          // AI_IDLE or AI_CHASE
+    unsigned int lastThink; // Tick of the last think
+    float attackCooldown; // Seconds until the next attack
+    int wheelNext;        // Next object in the same scheduler slot, -1 = end
+    unsigned int heardSound; // Generation of the last sound it reacted to
+} GameObject;
+
+#define AI_IDLE 0
+#define AI_CHASE 1
+#define AI_WHEEL_SLOTS 64 // Longest think interval + 1
+
+// --- Door State ---
+// Doors slide along a panel through the middle of their cell. `open` is how much of the cell
+// the panel has uncovered; it only changes while the door is on the session's moving list.
+typedef struct {
+    int mapX, mapY;
+    int isOpen;   // Where the door is heading
+    float open;   // 0 = closed .. 1 = fully open
+    int alongX;   // Panel spans x at y + 0.5 (else spans y at x + 0.5)
+} Door;
+
+#define DOOR_SPEED 1.6f // Fraction of the cell per second
+
+// --- Display Buffers ---
+// Main screen buffer
+char g_screenBuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+// Color buffer to store color codes for each position (index 0-6 corresponding to colors)
+char g_colorBuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+// Complete display buffer including HUD
+char g_displayBuffer[TOTAL_DISPLAY_HEIGHT][TOTAL_LINE_BUFFER_SIZE];
+// Z-buffer for depth testing
+float g_zBuffer[SCREEN_WIDTH];
+
+// Previous frame buffer for comparison (reduces flicker)
+char g_prevDisplayBuffer[TOTAL_DISPLAY_HEIGHT][TOTAL_LINE_BUFFER_SIZE];
+int g_firstFrame = 1;
+
+// --- Per-Frame Arena ---
+// All transient render data (sprite lists, spans, scratch buffers) is bump-allocated from one
+// block that is reset at the start of every frame. A frame that outgrows the block spills into
+// heap chunks; the next reset grows the block past the high-water mark so later frames fit and
+// the frame loop stops touching the heap. Each arena counts the mallocs and frees it makes.
+#define FRAME_ARENA_INITIAL_SIZE (64 * 1024)
+#define FRAME_ARENA_ALIGN 16
+
+typedef struct FrameArenaChunk {
+    struct FrameArenaChunk* next;
+} FrameArenaChunk;
+
+typedef struct {
+    unsigned char* base;
+    size_t capacity;
+    size_t used;               // Bytes handed out this frame from `base`
+    size_t frameBytes;         // Bytes requested this frame, including spills
+    size_t highWater;          // Largest frameBytes seen
+    FrameArenaChunk* spills;   // Heap chunks for requests that did not fit this frame
+    long frames;
+    long lastHeapFrame;        // Most recent frame that needed the heap
+    long heapCalls;            // Mallocs and frees made for this arena
+} FrameArena;
+
+void* frameHeapAlloc(FrameArena* arena, size_t size) {
+    arena->heapCalls++;
+    return malloc(size);
+}
+
+void frameHeapFree(FrameArena* arena, void* ptr) {
+    arena->heapCalls++;
+    free(ptr);
+}
+
+// Returns NULL only when a spill finds the heap exhausted
+void* arenaAlloc(FrameArena* arena, size_t size) {
+    size = (size + FRAME_ARENA_ALIGN - 1) & ~(size_t)(FRAME_ARENA_ALIGN - 1);
+    arena->frameBytes += size;
+    if (arena->used + size <= arena->capacity) {
+        void* ptr = arena->base + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+
+    // Spill: keep this frame going and let the next reset resize the block
+    FrameArenaChunk* chunk = frameHeapAlloc(arena, FRAME_ARENA_ALIGN + size);
+    if (!chunk) return NULL;
+    chunk->next = arena->spills;
+    arena->spills = chunk;
+    arena->lastHeapFrame = arena->frames;
+    return (unsigned char*)chunk + FRAME_ARENA_ALIGN;
+}
+
+// Starts a new frame: releases spills and grows the block to fit the worst frame so far.
+// Returns -1 if the block could not grow; the old one stays and big frames keep spilling.
+int arenaReset(FrameArena* arena) {
+    int status = 0;
+    while (arena->spills) {
+        FrameArenaChunk* next = arena->spills->next;
+        frameHeapFree(arena, arena->spills);
+        arena->spills = next;
+    }
+    if (arena->frameBytes > arena->highWater) {
+        arena->highWater = arena->frameBytes;
+    }
+    if (arena->highWater > arena->capacity || !arena->base) {
+        size_t capacity = arena->capacity ? arena->capacity : FRAME_ARENA_INITIAL_SIZE;
+        while (capacity < arena->highWater + arena->highWater / 4) capacity *= 2;
+        unsigned char* base = frameHeapAlloc(arena, capacity);
+        arena->lastHeapFrame = arena->frames;
+        if (!base) status = -1;
+        else {
+            if (arena->base) frameHeapFree(arena, arena->base);
+            arena->base = base;
+            arena->capacity = capacity;
+        }
+    }
+    arena->used = 0;
+    arena->frameBytes = 0;
+    arena->frames++;
+    return status;
+}
+
+// Grows the block ahead of time so frames of a known size never spill. Returns 0 on success
+int arenaReserve(FrameArena* arena, size_t bytes) {
+    if (arena->highWater < bytes) arena->highWater = bytes;
+    return arenaReset(arena);
+}
+
+void arenaRelease(FrameArena* arena) {
+    while (arena->spills) {
+        FrameArenaChunk* next = arena->spills->next;
+        frameHeapFree(arena, arena->spills);
+        arena->spills = next;
+    }
+    if (arena->base) frameHeapFree(arena, arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+}
+
+void printArenaReport(const FrameArena* arena) {
+    printf("Frame arena: %zu KB block, %zu KB high water, %ld heap calls, last at frame %ld of %ld\n",
+           arena->capacity / 1024, (arena->highWater + 1023) / 1024, arena->heapCalls,
+           arena->lastHeapFrame, arena->frames);
+}
+
+// --- Job System ---
+// Work-stealing scheduler for task graphs. Each thread owns a deque of ready jobs: it pushes
+// and pops at the bottom, and a thread that runs dry steals the oldest job from the top of
+// another's. A job becomes ready when the last job it waits on finishes, and goes onto the
+// finishing thread's deque, so follow-up work stays where its data is warm. Jobs and their
+// links are bump-allocated from a FrameArena and die with it. The submitting thread works
+// too, as owner of deque 0; one thread submits to a system at a time.
+// Builds without pthreads (Windows) run a graph serially in creation order, which is always
+// a valid order because a job can only wait on jobs created before it.
+#define JOB_DEQUE_SIZE 1024 // Power of two; a push into a full deque runs the job in place
+
+typedef void (*ParallelTask)(void* ctx, int index);
+
+typedef struct Job Job;
+typedef struct JobLink {
+    Job* job;
+    struct JobLink* next;
+} JobLink;
+
+#ifdef _WIN32
+typedef int JobCounter;
+#else
+typedef atomic_int JobCounter;
+#endif
+
+struct Job {
+    ParallelTask task;
+    void* ctx;
+    int index;
+    int prerequisites;   // Fixed once the graph runs; picks the jobs that start it
+    JobCounter waiting;  // Prerequisites still running
+    JobLink* dependents;
+    struct JobGraph* graph;
+    Job* next;           // Creation order
+};
+
+typedef struct JobGraph {
+    FrameArena* arena;
+    Job *first, *last;
+    int count;
+    int failed;          // A job or link could not be allocated; the graph will not run
+    JobCounter unfinished;
+} JobGraph;
+
+typedef struct {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    Job* items[JOB_DEQUE_SIZE];
+    unsigned int top, bottom; // Thieves take at top, the owner works at bottom
+} JobDeque;
+
+typedef struct JobSystem {
+    int numThreads;           // Including the submitting thread; one deque each
+    JobDeque* deques;
+#ifndef _WIN32
+    pthread_t* threads;
+    int numStarted;           // Worker threads to join
+    pthread_mutex_t sleepLock;
+    pthread_cond_t wake;
+    atomic_int queued;        // Jobs sitting in deques
+    int stopping;
+#endif
+    FrameArena arena;         // Graphs built by runJobs()
+} JobSystem;
+
+_Thread_local JobSystem* g_jobThreadSystem; // System the current thread works for, if any
+_Thread_local int g_jobThreadIndex;
+
+int cpuCount() {
+#ifdef _WIN32
+    return 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+void initJobGraph(JobGraph* graph, FrameArena* arena) {
+    graph->arena = arena;
+    graph->first = graph->last = NULL;
+    graph->count = 0;
+    graph->failed = 0;
+}
+
+// Returns NULL, and marks the graph failed, when the arena runs out
+Job* addJob(JobGraph* graph, ParallelTask task, void* ctx, int index) {
+    Job* job = arenaAlloc(graph->arena, sizeof(Job));
+    if (!job) {
+        graph->failed = 1;
+        return NULL;
+    }
+    job->task = task;
+    job->ctx = ctx;
+    job->index = index;
+    job->prerequisites = 0;
+    job->waiting = 0;
+    job->dependents = NULL;
+    job->graph = graph;
+    job->next = NULL;
+    if (graph->last) graph->last->next = job;
+    else graph->first = job;
+    graph->last = job;
+    graph->count++;
+    return job;
+}
+
+// `job` runs only after `prerequisite` has finished; both must belong to a graph not yet running.
+// A NULL from a failed addJob() is ignored, since its graph is already marked failed.
+void jobAfter(Job* job, Job* prerequisite) {
+    if (!job || !prerequisite) return;
+    JobLink* link = arenaAlloc(job->graph->arena, sizeof(JobLink));
+    if (!link) {
+        job->graph->failed = 1;
+        return;
+    }
+    link->job = job;
+    link->next = prerequisite->dependents;
+    prerequisite->dependents = link;
+    job->prerequisites++;
+    job->waiting++;
+}
+
+#ifndef _WIN32
+int pushJob(JobDeque* deque, Job* job) {
+    pthread_mutex_lock(&deque->lock);
+    int pushed = deque->bottom - deque->top < JOB_DEQUE_SIZE;
+    if (pushed) deque->items[deque->bottom++ & (JOB_DEQUE_SIZE - 1)] = job;
+    pthread_mutex_unlock(&deque->lock);
+    return pushed;
+}
+
+Job* takeJob(JobSystem* js, JobDeque* deque, int steal) {
+    Job* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        job = steal ? deque->items[deque->top++ & (JOB_DEQUE_SIZE - 1)]
+                    : deque->items[--deque->bottom & (JOB_DEQUE_SIZE - 1)];
+        atomic_fetch_sub(&js->queued, 1);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Own deque first (newest job), then the other threads' (oldest job)
+Job* findJob(JobSystem* js, int self) {
+    Job* job = takeJob(js, &js->deques[self], 0);
+    for (int i = 1; !job && i < js->numThreads; ++i) {
+        job = takeJob(js, &js->deques[(self + i) % js->numThreads], 1);
+    }
+    return job;
+}
+
+void executeJob(JobSystem* js, Job* job);
+
+void readyJob(JobSystem* js, Job* job) {
+    int self = g_jobThreadSystem == js ? g_jobThreadIndex : 0;
+    atomic_fetch_add(&js->queued, 1);
+    if (!pushJob(&js->deques[self], job)) {
+        atomic_fetch_sub(&js->queued, 1);
+        executeJob(js, job);
+        return;
+    }
+    pthread_mutex_lock(&js->sleepLock);
+    pthread_cond_signal(&js->wake);
+    pthread_mutex_unlock(&js->sleepLock);
+}
+
+void executeJob(JobSystem* js, Job* job) {
+    job->task(job->ctx, job->index);
+    for (JobLink* link = job->dependents; link; link = link->next) {
+        if (atomic_fetch_sub(&link->job->waiting, 1) == 1) readyJob(js, link->job);
+    }
+    atomic_fetch_sub(&job->graph->unfinished, 1);
+}
+
+void* jobWorker(void* arg) {
+    JobSystem* js = arg;
+    g_jobThreadSystem = js;
+    for (;;) {
+        Job* job = findJob(js, g_jobThreadIndex);
+        if (job) {
+            executeJob(js, job);
+            continue;
+        }
+        pthread_mutex_lock(&js->sleepLock);
+        while (atomic_load(&js->queued) == 0 && !js->stopping) pthread_cond_wait(&js->wake, &js->sleepLock);
+        int stopping = js->stopping;
+        pthread_mutex_unlock(&js->sleepLock);
+        if (stopping) return NULL;
+    }
+}
+
+typedef struct {
+    JobSystem* js;
+    int index;
+} JobWorkerStart;
+
+void* startJobWorker(void* arg) {
+    JobWorkerStart start = *(JobWorkerStart*)arg;
+    free(arg);
+    g_jobThreadIndex = start.index;
+    return jobWorker(start.js);
+}
+#endif
+
+// `threads` counts the submitting thread; 0 means one per core. Returns 0 on success
+int initJobSystem(JobSystem* js, int threads) {
+    memset(js, 0, sizeof(*js));
+#ifdef _WIN32
+    threads = 1;
+#else
+    if (threads <= 0) threads = cpuCount();
+#endif
+    js->numThreads = 1;
+    js->deques = calloc(threads, sizeof(JobDeque));
+    if (!js->deques) return -1;
+#ifndef _WIN32
+    js->threads = calloc(threads, sizeof(pthread_t));
+    if (!js->threads) return -1;
+    pthread_mutex_init(&js->sleepLock, NULL);
+    pthread_cond_init(&js->wake, NULL);
+    atomic_init(&js->queued, 0);
+    for (int i = 0; i < threads; ++i) {
+        pthread_mutex_init(&js->deques[i].lock, NULL);
+    }
+    // Workers scan every deque, so the count is fixed before they start. A worker that fails
+    // to start only leaves an empty deque behind: jobs go onto the deque of the thread readying them.
+    js->numThreads = threads;
+    for (int i = 1; i < threads; ++i) {
+        JobWorkerStart* start = malloc(sizeof(JobWorkerStart));
+        if (!start) break;
+        *start = (JobWorkerStart){ js, i };
+        if (pthread_create(&js->threads[js->numStarted], NULL, startJobWorker, start) != 0) {
+            free(start);
+            break;
+        }
+        js->numStarted++;
+    }
+    if (js->numStarted == 0) js->numThreads = 1;
+#endif
+    return 0;
+}
+
+void freeJobSystem(JobSystem* js) {
+#ifndef _WIN32
+    if (js->threads) {
+        pthread_mutex_lock(&js->sleepLock);
+        js->stopping = 1;
+        pthread_cond_broadcast(&js->wake);
+        pthread_mutex_unlock(&js->sleepLock);
+        for (int i = 0; i < js->numStarted; ++i) {
+            pthread_join(js->threads[i], NULL);
+        }
+        for (int i = 0; i < js->numThreads; ++i) {
+            pthread_mutex_destroy(&js->deques[i].lock);
+        }
+        pthread_mutex_destroy(&js->sleepLock);
+        pthread_cond_destroy(&js->wake);
+        free(js->threads);
+        js->threads = NULL;
+    }
+#endif
+    free(js->deques);
+    js->deques = NULL;
+    arenaRelease(&js->arena);
+}
+
+// Runs a graph to completion; a NULL or single-threaded system runs it in creation order.
+// Returns -1, running nothing, if the graph could not be fully built.
+int runJobGraph(JobSystem* js, JobGraph* graph) {
+    if (graph->failed) return -1;
+#ifndef _WIN32
+    if (js && js->numThreads > 1 && graph->count > 1) {
+        atomic_init(&graph->unfinished, graph->count);
+        // Not `waiting`: workers already running the first jobs count it down, and a job
+        // readied by them would be queued here a second time
+        for (Job* job = graph->first; job; job = job->next) {
+            if (job->prerequisites == 0) readyJob(js, job);
+        }
+        while (atomic_load(&graph->unfinished) > 0) {
+            Job* job = findJob(js, 0);
+            if (job) executeJob(js, job);
+            else sched_yield(); // The rest is running elsewhere
+        }
+        return 0;
+    }
+#endif
+    for (Job* job = graph->first; job; job = job->next) {
+        job->task(job->ctx, job->index);
+    }
+    return 0;
+}
+
+// Runs task(ctx, 0..count-1) as independent jobs
+void runJobs(JobSystem* js, int count, ParallelTask task, void* ctx) {
+    if (js && js->numThreads > 1) {
+        arenaReset(&js->arena);
+        JobGraph graph;
+        initJobGraph(&graph, &js->arena);
+        for (int i = 0; i < count; ++i) {
+            addJob(&graph, task, ctx, i);
+        }
+        if (runJobGraph(js, &graph) == 0) return;
+    }
+    // No workers, or no memory for the graph
+    for (int i = 0; i < count; ++i) {
+        task(ctx, i);
+    }
+}
+
+// Process-wide system for the terminal game and offline rendering, started on first use
+JobSystem* sharedJobSystem() {
+    static JobSystem js;
+    static int started = 0;
+    if (!started) {
+        if (initJobSystem(&js, 0) != 0) return NULL;
+        started = 1;
+    }
+    return &js;
+}
+
+void runParallel(int count, ParallelTask task, void* ctx) {
+    runJobs(sharedJobSystem(), count, task, ctx);
+}
+
+// --- Non-blocking input globals (Linux specific) ---
+#ifndef _WIN32
+static struct termios g_oldTermios;
+
+void setupNonBlockingInput() {
+    struct termios newTermios;
+    tcgetattr(STDIN_FILENO, &g_oldTermios);
+    newTermios = g_oldTermios;
+    newTermios.c_lflag &= ~(ICANON | ECHO);
+    newTermios.c_cc[VMIN] = 0;
+    newTermios.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &newTermios);
+
+    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+}
+
+void restoreBlockingInput() {
+    tcsetattr(STDIN_FILENO, TCSANOW, &g_oldTermios);
+    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
+}
+#endif
+
+// --- Timing ---
+double nowSeconds() {
+#ifdef _WIN32
+    return GetTickCount64() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// --- Key State Tracking ---
+// Plain terminals only send bytes on press and auto-repeat, never on release, so a movement
+// key counts as held until it goes quiet for longer than the expected repeat gap. The first
+// gap (the OS repeat delay) is much longer than later ones; both gaps are learned from the
+// observed repeat stream so a quick tap does not keep the key down for long. Terminals that
+// speak the kitty keyboard protocol send explicit press/repeat/release events instead.
+#define KEY_INITIAL_HOLD_SECONDS 0.55 // Starting guess covering the usual 250-500ms repeat delay
+#define KEY_REPEAT_HOLD_SECONDS 0.12  // Starting guess covering the gap between repeats (~30/s)
+#define KEY_HOLD_MARGIN 1.3           // Slack applied to learned gaps before a key times out
+#define INPUT_MAX_BYTES_PER_FRAME 256 // Bursts beyond this wait for the next frame
+
+typedef enum {
+    KEY_FORWARD,
+    KEY_BACK,
+    KEY_STRAFE_LEFT,
+    KEY_STRAFE_RIGHT,
+    KEY_TURN_LEFT,
+    KEY_TURN_RIGHT,
+    KEY_COUNT
+} HeldKey;
+
+// One-shot actions (ACTION_* in minidoom.h), collected as a bitmask so any number of repeats
+// within a tick costs one action. Exit only exists in the terminal game.
+#define ACTION_EXIT (1u << 16)
+
+typedef struct {
+    int down;             // 1 while the key is considered held
+    int repeating;        // Auto-repeat seen since the press (switches to the short timeout)
+    int explicitRelease;  // Held until a kitty release event instead of timing out
+    double pressTime;     // Time the key went down
+    double lastEventTime; // Time of the last press/repeat byte
+} KeyState;
+
+KeyState g_keys[KEY_COUNT];
+double g_initialHoldSeconds = KEY_INITIAL_HOLD_SECONDS;
+double g_repeatHoldSeconds = KEY_REPEAT_HOLD_SECONDS;
+unsigned int g_pendingActions = 0;
+int g_kittyKeyboard = 0; // Set once the terminal answers the kitty protocol query
+
+// Escape-sequence parser state (sequences may be split across reads)
+#define INPUT_SEQ_MAX 32
+char g_inputSeq[INPUT_SEQ_MAX];
+int g_inputSeqLen = 0;
+
+enum { KEY_EVENT_PRESS = 1, KEY_EVENT_REPEAT = 2, KEY_EVENT_RELEASE = 3 };
+
+void setupKeyboardProtocol() {
+#ifndef _WIN32
+    // Push kitty flags 1|2|8 (disambiguate, report event types, all keys as escapes) and query
+    // support. Terminals without the protocol ignore both and we stay on the timeout heuristic.
+    printf("\x1b[>11u\x1b[?u");
+    fflush(stdout);
+#endif
+}
+
+void restoreKeyboardProtocol() {
+#ifndef _WIN32
+    printf("\x1b[<u");
+    fflush(stdout);
+#endif
+}
+
+// Arrow keys, outside the character range used by plain keys
+#define KEYCODE_ARROW_UP    0x101
+#define KEYCODE_ARROW_DOWN  0x102
+#define KEYCODE_ARROW_RIGHT 0x103
+#define KEYCODE_ARROW_LEFT  0x104
+
+// Applies one key event. `code` is a lower-case character or a KEYCODE_ARROW_* value.
+void handleKeyEvent(int code, int eventType, int fromKitty, double now) {
+    int held = -1;
+    switch (code) {
+        case 'w': case KEYCODE_ARROW_UP: held = KEY_FORWARD; break;
+        case 's': case KEYCODE_ARROW_DOWN: held = KEY_BACK; break;
+        case 'a': held = KEY_STRAFE_LEFT; break;
+        case 'd': held = KEY_STRAFE_RIGHT; break;
+        case 'q': case KEYCODE_ARROW_LEFT: held = KEY_TURN_LEFT; break;
+        case 'e': case KEYCODE_ARROW_RIGHT: held = KEY_TURN_RIGHT; break;
+        case 'f': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_INTERACT; return;
+        case ' ': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_SHOOT; return;
+        case 'r': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_LOOK_UP; return;
+        case 'v': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_LOOK_DOWN; return;
+        case 'j': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_JUMP; return;
+        case 'c': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_CROUCH; return;
+        case 'x': if (eventType != KEY_EVENT_RELEASE) g_pendingActions |= ACTION_EXIT; return;
+        default: return;
+    }
+
+    KeyState* key = &g_keys[held];
+    if (eventType == KEY_EVENT_RELEASE) {
+        key->down = 0;
+        return;
+    }
+    if (eventType == KEY_EVENT_PRESS || !key->down) {
+        key->down = 1;
+        key->repeating = 0;
+        key->pressTime = now;
+    } else {
+        // Legacy bytes count as repeats once the key is already down; learn the terminal's gaps
+        if (!fromKitty) {
+            if (!key->repeating) {
+                double delay = (now - key->pressTime) * KEY_HOLD_MARGIN;
+                if (delay > 0.15 && delay < 1.0) g_initialHoldSeconds = delay;
+            } else {
+                double gap = (now - key->lastEventTime) * KEY_HOLD_MARGIN;
+                if (gap > 0.02 && gap < 0.25) g_repeatHoldSeconds = 0.75 * g_repeatHoldSeconds + 0.25 * gap;
+            }
+        }
+        key->repeating = 1;
+    }
+    key->explicitRelease = fromKitty;
+    key->lastEventTime = now;
+}
+
+// Parses a complete CSI sequence in g_inputSeq ("\x1b[" params final)
+void handleCsiSequence(double now) {
+    char final = g_inputSeq[g_inputSeqLen - 1];
+    const char* params = g_inputSeq + 2;
+
+    if (params[0] == '?' && final == 'u') {
+        g_kittyKeyboard = 1; // Reply to the flags query
+        return;
+    }
+
+    // "code[:alternates][;modifiers[:event]]" - every field is optional. Without an explicit
+    // event, kitty means a press while a legacy arrow sequence is just another repeat byte.
+    int code = 1;
+    int eventType = g_kittyKeyboard || final == 'u' ? KEY_EVENT_PRESS : KEY_EVENT_REPEAT;
+    int section = 0, sub = 0, value = -1;
+    for (const char* p = params; p < g_inputSeq + g_inputSeqLen; ++p) {
+        if (*p >= '0' && *p <= '9') {
+            value = (value < 0 ? 0 : value * 10) + (*p - '0');
+            continue;
+        }
+        if (value >= 0) {
+            if (section == 0 && sub == 0) code = value;
+            else if (section == 1 && sub == 1) eventType = value;
+        }
+        value = -1;
+        if (*p == ';') {
+            section++;
+            sub = 0;
+        } else if (*p == ':') {
+            sub++;
+        }
+    }
+
+    int fromKitty = g_kittyKeyboard;
+    switch (final) {
+        case 'u':
+            if (code >= 'A' && code <= 'Z') code += 'a' - 'A';
+            handleKeyEvent(code, eventType, 1, now);
+            break;
+        case 'A': handleKeyEvent(KEYCODE_ARROW_UP, eventType, fromKitty, now); break;
+        case 'B': handleKeyEvent(KEYCODE_ARROW_DOWN, eventType, fromKitty, now); break;
+        case 'C': handleKeyEvent(KEYCODE_ARROW_RIGHT, eventType, fromKitty, now); break;
+        case 'D': handleKeyEvent(KEYCODE_ARROW_LEFT, eventType, fromKitty, now); break;
+        default: break; // Other sequences (focus, function keys, ...) are ignored
+    }
+}
+
+void handleInputByte(unsigned char c, double now) {
+    if (g_inputSeqLen > 0) {
+        if (g_inputSeqLen == 1 && c != '[') {
+            g_inputSeqLen = 0; // Lone ESC; treat the byte as a normal key below
+        } else {
+            g_inputSeq[g_inputSeqLen++] = c;
+            if (g_inputSeqLen > 2 && c >= 0x40 && c <= 0x7E) {
+                handleCsiSequence(now);
+                g_inputSeqLen = 0;
+            } else if (g_inputSeqLen >= INPUT_SEQ_MAX) {
+                g_inputSeqLen = 0; // Malformed or unknown; drop it
+            }
+            return;
+        }
+    }
+    if (c == 0x1b) {
+        g_inputSeq[0] = c;
+        g_inputSeqLen = 1;
+        return;
+    }
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    handleKeyEvent(c, KEY_EVENT_REPEAT, 0, now);
+}
+
+// HeldKey order matches the movement ACTION_* bits
+unsigned int heldKeyMask() {
+    unsigned int mask = 0;
+    for (int k = 0; k < KEY_COUNT; ++k) {
+        if (g_keys[k].down) mask |= 1u << k;
+    }
+    return mask;
+}
+
+// Drains pending input (bounded per frame) and expires legacy keys whose repeats have stopped
+void pollInput(double now) {
+    unsigned char buf[INPUT_MAX_BYTES_PER_FRAME];
+    int count = 0;
+#ifdef _WIN32
+    while (count < INPUT_MAX_BYTES_PER_FRAME && _kbhit()) {
+        buf[count++] = (unsigned char)_getch();
+    }
+#else
+    int bytesRead = read(STDIN_FILENO, buf, sizeof(buf));
+    if (bytesRead > 0) count = bytesRead;
+#endif
+    for (int i = 0; i < count; ++i) {
+        handleInputByte(buf[i], now);
+    }
+
+    for (int k = 0; k < KEY_COUNT; ++k) {
+        KeyState* key = &g_keys[k];
+        if (!key->down || key->explicitRelease) continue;
+        double hold = key->repeating ? g_repeatHoldSeconds : g_initialHoldSeconds;
+        if (now - key->lastEventTime > hold) {
+            key->down = 0;
+        }
+    }
+}
+
+// --- Improved screen management ---
+void initializeDisplay() {
+    // Clear screen once at startup and hide cursor
+    printf(ANSI_CLEAR_SCREEN ANSI_CURSOR_HOME ANSI_HIDE_CURSOR);
+    fflush(stdout);
+}
+
+void finalizeDisplay() {
+    // Show cursor and reset colors
+    printf(ANSI_SHOW_CURSOR ANSI_COLOR_RESET);
+    fflush(stdout);
+}
+
+void updateDisplay() {
+    // Only update changed lines to reduce flicker
+    printf(ANSI_CURSOR_HOME); // Move cursor to top-left
+    
+    for (int y = 0; y < TOTAL_DISPLAY_HEIGHT; ++y) {
+        // Compare with previous frame
+        if (g_firstFrame || strcmp(g_displayBuffer[y], g_prevDisplayBuffer[y]) != 0) {
+            printf("\x1b[%d;1H", y + 1); // Move to specific line
+            printf("%s", g_displayBuffer[y]);
+            strcpy(g_prevDisplayBuffer[y], g_displayBuffer[y]); // Update previous buffer
+        }
+    }
+    
+    g_firstFrame = 0;
+    fflush(stdout);
+}
+
+// --- Particle Storage ---
+// Impact effects live in a fixed-capacity ring stored structure-of-arrays, so integration is a
+// straight pass over float arrays (four lanes at a time where the compiler supports vector
+// types). Spawning past the capacity overwrites the oldest particles. Height `z` runs from 0
+// (floor) to 1 (ceiling), and particles are depth-tested against the per-pixel depth when drawn.
+#define PARTICLE_CAPACITY 65536    // Terminal game; power of two, multiple of 4
+#define ENV_PARTICLE_CAPACITY 1024 // Environment sessions
+#define PARTICLE_AIR_DRAG 1.5f     // Fraction of velocity lost per second
+
+#if defined(__GNUC__)
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+#endif
+
+typedef enum {
+    PARTICLE_SPARK,
+    PARTICLE_BLOOD,
+    PARTICLE_SMOKE,
+    NUM_PARTICLE_KINDS
+} ParticleKind;
+
+typedef struct {
+    float *x, *y, *z;
+    float *vx, *vy, *vz;
+    float* gravity;          // Upward acceleration (negative falls, smoke rises)
+    float* life;             // Seconds left; dead at or below zero
+    unsigned char* kind;
+    void* block;             // One allocation backing every array, 16-byte aligned inside
+    unsigned int capacity;
+    unsigned int head;       // Next slot to (re)use
+    unsigned int used;       // Slots ever written, up to the capacity
+    float longestLife;       // Seconds until every particle is dead
+    unsigned int rng;
+} ParticleSystem;
+
+// Returns 0 on success
+int initParticleSystem(ParticleSystem* ps, unsigned int capacity) {
+    size_t floats = (size_t)capacity * sizeof(float);
+    ps->block = calloc(1, floats * 8 + capacity + 15);
+    if (!ps->block) return -1;
+    unsigned char* p = (unsigned char*)(((size_t)ps->block + 15) & ~(size_t)15);
+    float** arrays[8] = { &ps->x, &ps->y, &ps->z, &ps->vx, &ps->vy, &ps->vz, &ps->gravity, &ps->life };
+    for (int i = 0; i < 8; ++i) {
+        *arrays[i] = (float*)p;
+        p += floats;
+    }
+    ps->kind = p;
+    ps->capacity = capacity;
+    ps->head = 0;
+    ps->used = 0;
+    ps->longestLife = 0.0f;
+    ps->rng = 0x9E3779B9u;
+    return 0;
+}
+
+void freeParticleSystem(ParticleSystem* ps) {
+    free(ps->block);
+    ps->block = NULL;
+}
+
+// --- Dithered Shading ---
+// Distance shading picks glyphs from short ramps. Instead of stepping from one glyph to the
+// next at fixed distances, each distance maps to a position along the ramp and an ordered
+// (4x4 Bayer) dither mixes the two nearest levels in proportion: pure at the middle of a
+// band, half and half at its edge. The threshold depends only on the screen cell, so a still
+// camera draws the same cells every frame and the display diff stays quiet.
+#define BAYER(v) (((v) + 0.5f) / 16.0f - 0.5f)
+
+const float g_bayerThresholds[4][4] = { // Row, column; centred on zero
+    { BAYER(0), BAYER(8), BAYER(2), BAYER(10) },
+    { BAYER(12), BAYER(4), BAYER(14), BAYER(6) },
+    { BAYER(3), BAYER(11), BAYER(1), BAYER(9) },
+    { BAYER(15), BAYER(7), BAYER(13), BAYER(5) },
+};
+
+const char g_wallRamp[] = "#=-.";     // Bands 3 units deep
+const char g_floorRamp[] = "#=-, ";   // Bands 2 units deep to 6, then 4
+
+// Glyph of `ramp` (with `levels` glyphs) at `position`, dithered by `threshold`
+char ditherRamp(const char* ramp, int levels, double position, float threshold) {
+    double level = position + threshold; // Below 1 is the first glyph either way, so no floor()
+    return ramp[level < 1.0 ? 0 : level >= levels ? levels - 1 : (int)level];
+}
+
+double wallRampPosition(double dist) {
+    return dist / 3.0;
+}
+
+double floorRampPosition(double dist) {
+    return dist < 6.0 ? dist / 2.0 : 3.0 + (dist - 6.0) / 4.0;
+}
+
+// --- View Rows ---
+// Looking up or down shears the view: everything moves by the same number of rows, so the
+// horizon's row is all that changes. Raising or lowering the eye splits each wall span
+// unevenly about the horizon and changes how far away each floor and ceiling row is. A row's
+// glyphs therefore depend only on the horizon, the eye height, the row and (for the dither)
+// the column modulo 4, so a session keeps four glyphs per row for the view it last drew and
+// rebuilds them only when one of those changes.
+typedef struct {
+    char* glyphs;       // Floor/ceiling glyphs, 4 per row by column & 3
+    float* invDepth;    // 1 / distance to the floor/ceiling seen on each row, 0 on the horizon
+    int capacity;
+    int height, shift;  // View the glyphs were built for; shift is the horizon's offset in rows
+    float eyeHeight;
+} ViewRows;
+
+// Rows the horizon moves for `pitch` in a view `height` rows tall
+int pitchShift(float pitch, int height) {
+    return (int)lroundf(pitch * height);
+}
+
+// Builds the row glyphs for a horizon `shift` rows below the middle and an eye `eyeHeight`
+// wall heights above the floor, unless already built. Returns -1, leaving `rows` as it was,
+// if it cannot grow to `height` rows.
+int prepareViewRows(ViewRows* rows, int height, int shift, float eyeHeight) {
+    if (rows->glyphs && rows->height == height && rows->shift == shift && rows->eyeHeight == eyeHeight) return 0;
+    if (height > rows->capacity) {
+        float* block = realloc(rows->invDepth, height * (sizeof(float) + 4)); // Depths, then glyphs
+        if (!block) return -1;
+        rows->invDepth = block;
+        rows->glyphs = (char*)(block + height);
+        rows->capacity = height;
+    }
+    // Rows from the horizon to where the floor (ceiling) meets a wall 1 unit away
+    double belowEye = eyeHeight * (double)height, aboveEye = (1.0f - eyeHeight) * (double)height;
+    double horizon = height / 2.0 + shift;
+    for (int y = 0; y < height; ++y) {
+        double rowsAway = y > horizon ? y - horizon : horizon - y;
+        double rowsToWall = y > horizon ? belowEye : aboveEye;
+        double position = rowsAway > 0.0 ? floorRampPosition(rowsToWall / rowsAway) : 1e9;
+        for (int column = 0; column < 4; ++column) {
+            rows->glyphs[y * 4 + column] = ditherRamp(g_floorRamp, 5, position, g_bayerThresholds[y & 3][column]);
+        }
+        rows->invDepth[y] = (float)(rowsAway / rowsToWall);
+    }
+    rows->height = height;
+    rows->shift = shift;
+    rows->eyeHeight = eyeHeight;
+    return 0;
+}
+
+void freeViewRows(ViewRows* rows) {
+    free(rows->invDepth);
+    memset(rows, 0, sizeof(*rows));
+}
+
+// --- Game Session ---
+// Everything one game needs to advance and render: player, objects, doors, particles and its
+// own frame arena. The terminal game plays g_game; the environment API creates its own.
+struct GameSession {
+    Player player;
+    GameObject objects[MAX_GAME_OBJECTS];
+    int numObjects;
+    Door doors[MAX_DOORS];
+    int numDoors;
+    short movingDoors[MAX_DOORS];         // Indices of doors mid-slide
+    int numMovingDoors;
+    unsigned char triggerHead[MAP_MAX_HEIGHT][MAP_MAX_WIDTH]; // First trigger on the cell + 1, 0 = none
+    unsigned char triggerNext[MAX_TRIGGERS];          // Next trigger on the same cell + 1
+    unsigned char triggerFired[MAX_TRIGGERS];
+    unsigned int tick;                // Ticks since reset
+    unsigned int alertStamp[MAP_MAX_HEIGHT][MAP_MAX_WIDTH]; // Generation of the last sound to reach each cell
+    unsigned char soundLevel[MAP_MAX_HEIGHT][MAP_MAX_WIDTH]; // Loudness it arrived with; valid where stamped
+    unsigned int soundGeneration;
+    int aiWheel[AI_WHEEL_SLOTS];      // Enemies due to think, by tick modulo the slot count
+    int aiWheelTail[AI_WHEEL_SLOTS];  // Last enemy in each slot, -1 = empty
+    ParticleSystem particles;
+    FrameArena arena;
+    ViewRows viewRows;       // Floor/ceiling rows for the view last rendered
+    int obsWidth, obsHeight; // Environment observation size
+    struct SharedFrameExport* shared; // Set while the session publishes its frames
+    const SectorMap* sectorMap;       // Render through sectors and portals instead of the grid
+    const BspTree* bspTree;           // Render by walking a BSP tree (takes precedence)
+};
+
+GameSession g_game;
+
+// --- AI Scheduler ---
+// Enemies think at a rate set by their importance: every tick when near or in sight, every
+// few ticks at mid range, rarely when far away or dormant. Each think books the next one in a
+// timing wheel, and a tick only visits its own slot, running at most AI_THINK_BUDGET thinks;
+// the rest of the slot moves, in order and in one step, to the front of the next tick's. AI
+// cost per tick is bounded however many enemies a map has.
+#define AI_THINK_BUDGET 8
+
+// Books object `index` to think `delay` ticks from now (at least one), after those already due
+void scheduleThink(GameSession* game, int index, unsigned int delay) {
+    if (delay < 1) delay = 1;
+    if (delay >= AI_WHEEL_SLOTS) delay = AI_WHEEL_SLOTS - 1;
+    int slot = (game->tick + delay) % AI_WHEEL_SLOTS;
+    game->objects[index].wheelNext = -1;
+    if (game->aiWheelTail[slot] >= 0) game->objects[game->aiWheelTail[slot]].wheelNext = index;
+    else game->aiWheel[slot] = index;
+    game->aiWheelTail[slot] = index;
+}
+
+// --- Initialize Game Objects and Doors from map ---
+void initializeGameElements(GameSession* game) {
+    game->numMovingDoors = 0;
+    game->tick = 0;
+    memset(game->aiWheel, -1, sizeof(game->aiWheel));
+    memset(game->aiWheelTail, -1, sizeof(game->aiWheelTail));
+    memset(game->alertStamp, 0, sizeof(game->alertStamp));
+    game->soundGeneration = 0;
+    // Index triggers by cell so events only look at their own cell
+    memset(game->triggerHead, 0, sizeof(game->triggerHead));
+    memset(game->triggerFired, 0, sizeof(game->triggerFired));
+    int numTriggers = g_numLevelTriggers < MAX_TRIGGERS ? g_numLevelTriggers : MAX_TRIGGERS; // The rest are ignored
+    for (int i = numTriggers - 1; i >= 0; --i) {
+        const TriggerDef* def = &g_levelTriggers[i];
+        game->triggerNext[i] = game->triggerHead[def->mapY][def->mapX];
+        game->triggerHead[def->mapY][def->mapX] = (unsigned char)(i + 1);
+    }
+    game->numObjects = 0;
+    game->numDoors = 0;
+    for (int y = 0; y < g_mapHeight; ++y) {
+        for (int x = 0; x < g_mapWidth; ++x) {
+            if (g_map[y][x] == 'H') {
+                if (game->numObjects < MAX_GAME_OBJECTS) {
+                    game->objects[game->numObjects] = (GameObject){.x = x + 0.5f, .y = y + 0.5f, .displayChar = '+', .color = ANSI_COLOR_GREEN, .type = OBJ_HEALTH, .active = 1, .health = 0, .sprite = SPRITE_MEDKIT};
+                    game->numObjects++;
+                }
+            } else if (g_map[y][x] == 'A') {
+                if (game->numObjects < MAX_GAME_OBJECTS) {
+                    game->objects[game->numObjects] = (GameObject){.x = x + 0.5f, .y = y + 0.5f, .displayChar = '!', .color = ANSI_COLOR_YELLOW, .type = OBJ_AMMO, .active = 1, .health = 0, .sprite = SPRITE_AMMO_BOX};
+                    game->numObjects++;
+                }
+            } else if (g_map[y][x] == 'E') {
+                if (game->numObjects < MAX_GAME_OBJECTS) {
+                    game->objects[game->numObjects] = (GameObject){.x = x + 0.5f, .y = y + 0.5f, .displayChar = 'M', .color = ANSI_COLOR_RED, .type = OBJ_ENEMY, .active = 1, .health = 50, .sprite = SPRITE_IMP, .aiState = AI_IDLE};
+                    scheduleThink(game, game->numObjects, 1 + game->numObjects % 4); // Stagger first thinks
+                    game->numObjects++;
+                }
+            } else if (g_map[y][x] == 'D') {
+                if (game->numDoors < MAX_DOORS) {
+                    game->doors[game->numDoors] = (Door){.mapX = x, .mapY = y, .isOpen = 0, .open = 0.0f, .alongX = doorRunsAlongX(x, y)};
+                    game->numDoors++;
+                }
+            }
+        }
+    }
+}
+
+// --- Door Animation ---
+// Moves `current` toward `target` by at most `maxDelta`
+float approach(float current, float target, float maxDelta) {
+    if (current < target) return (current + maxDelta > target) ? target : current + maxDelta;
+    return (current - maxDelta < target) ? target : current - maxDelta;
+}
+
+Door* findDoor(const GameSession* game, int mapX, int mapY) {
+    for (int i = 0; i < game->numDoors; ++i) {
+        if (game->doors[i].mapX == mapX && game->doors[i].mapY == mapY) return (Door*)&game->doors[i];
+    }
+    return NULL;
+}
+
+// Whether the panel covers (x, y), a point inside the door's cell. The panel slides toward the
+// low end of its span, so the uncovered part is [0, open) along it.
+int doorBlocksPoint(const Door* door, float open, float x, float y) {
+    float along = door->alongX ? x - door->mapX : y - door->mapY;
+    return along >= open;
+}
+
+// Where a ray from (originX, originY) meets the door panel: returns the distance along the ray
+// (in units of the ray direction), or -1 if it passes through the open part or misses the cell
+double intersectDoor(const Door* door, double originX, double originY, double rayDirX, double rayDirY) {
+    double dirAcross = door->alongX ? rayDirY : rayDirX;
+    if (dirAcross == 0.0) return -1.0;
+    double dist = door->alongX ? (door->mapY + 0.5 - originY) / rayDirY : (door->mapX + 0.5 - originX) / rayDirX;
+    double along = door->alongX ? originX + dist * rayDirX - door->mapX : originY + dist * rayDirY - door->mapY;
+    if (dist <= 0.0 || along < door->open || along >= 1.0) return -1.0;
+    return dist;
+}
+
+// Sends a door toward its isOpen state; the scheduler animates it from the next tick
+void setDoorTarget(GameSession* game, int index, int isOpen) {
+    game->doors[index].isOpen = isOpen;
+    for (int i = 0; i < game->numMovingDoors; ++i) {
+        if (game->movingDoors[i] == index) return;
+    }
+    game->movingDoors[game->numMovingDoors++] = (short)index;
+}
+
+// Advances only the doors that are moving; idle doors are never visited. A closing door that
+// would shut on the player opens again.
+void updateDoors(GameSession* game, float dt) {
+    for (int i = 0; i < game->numMovingDoors;) {
+        Door* door = &game->doors[game->movingDoors[i]];
+        float target = door->isOpen ? 1.0f : 0.0f;
+        float next = approach(door->open, target, DOOR_SPEED * dt);
+        if (!door->isOpen && (int)game->player.x == door->mapX && (int)game->player.y == door->mapY &&
+            doorBlocksPoint(door, next, game->player.x, game->player.y)) {
+            door->isOpen = 1;
+            ++i;
+            continue;
+        }
+        door->open = next;
+        if (next == target) {
+            game->movingDoors[i] = game->movingDoors[--game->numMovingDoors];
+        } else {
+            ++i;
+        }
+    }
+}
+
+// --- Trigger Events ---
+typedef enum {
+    TRIGGER_ENTER,
+    TRIGGER_EXIT,
+    TRIGGER_USE,
+} TriggerEvent;
+
+void setDoorAt(GameSession* game, int mapX, int mapY, int isOpen) {
+    Door* door = findDoor(game, mapX, mapY);
+    if (door && door->isOpen != isOpen) setDoorTarget(game, (int)(door - game->doors), isOpen);
+}
+
+// Runs the triggers on one cell for an event; returns how many reacted
+int fireTriggers(GameSession* game, int mapX, int mapY, TriggerEvent event) {
+    if (mapX < 0 || mapX >= g_mapWidth || mapY < 0 || mapY >= g_mapHeight) return 0;
+    int reacted = 0;
+    for (int i = game->triggerHead[mapY][mapX] - 1; i >= 0; i = game->triggerNext[i] - 1) {
+        const TriggerDef* def = &g_levelTriggers[i];
+        switch (def->kind) {
+            case TRIGGER_PLATE:
+                if (event == TRIGGER_USE) continue;
+                setDoorAt(game, def->targetX, def->targetY, event == TRIGGER_ENTER);
+                break;
+            case TRIGGER_SWITCH: {
+                if (event != TRIGGER_USE) continue;
+                const Door* door = findDoor(game, def->targetX, def->targetY);
+                if (door) setDoorAt(game, def->targetX, def->targetY, !door->isOpen);
+                break;
+            }
+            case TRIGGER_SPAWN:
+                if (event != TRIGGER_ENTER || game->triggerFired[i] || game->numObjects >= MAX_GAME_OBJECTS) continue;
+                game->objects[game->numObjects] = (GameObject){.x = def->targetX + 0.5f, .y = def->targetY + 0.5f, .displayChar = 'M', .color = ANSI_COLOR_RED, .type = OBJ_ENEMY, .active = 1, .health = 50, .sprite = SPRITE_IMP, .aiState = AI_CHASE, .lastThink = game->tick};
+                scheduleThink(game, game->numObjects++, 1);
+                break;
+        }
+        game->triggerFired[i] = 1;
+        reacted++;
+    }
+    return reacted;
+}
+
+// Movement only costs anything when the player crosses into another cell
+void crossCells(GameSession* game, float fromX, float fromY) {
+    int oldX = (int)fromX, oldY = (int)fromY;
+    int newX = (int)game->player.x, newY = (int)game->player.y;
+    if (oldX == newX && oldY == newY) return;
+    fireTriggers(game, oldX, oldY, TRIGGER_EXIT);
+    fireTriggers(game, newX, newY, TRIGGER_ENTER);
+}
+
+// --- Sound Propagation ---
+// A noise floods outward over walkable cells, losing one level per cell and more through
+// doors that are not fully open, and stamps each cell it reaches with its generation. Enemies
+// check their own cell's stamp when they think, so a sound costs what its flood touches and
+// never loops over entities. The stamp doubles as the visited mark, so nothing is cleared.
+#define SOUND_SHOT_LOUDNESS 12 // Cells a shot carries in the open
+#define SOUND_DOOR_LOSS 6      // Extra levels lost through a closed door
+
+void emitSound(GameSession* game, int sourceX, int sourceY, int loudness) {
+    if (sourceX < 0 || sourceX >= g_mapWidth || sourceY < 0 || sourceY >= g_mapHeight) return;
+    unsigned int generation = ++game->soundGeneration;
+    // A cell is only queued again when reached louder, which is rare; the ring covers the map
+    unsigned char queueX[MAP_MAX_WIDTH * MAP_MAX_HEIGHT], queueY[MAP_MAX_WIDTH * MAP_MAX_HEIGHT];
+    int head = 0, tail = 0, size = g_mapWidth * g_mapHeight;
+    game->alertStamp[sourceY][sourceX] = generation;
+    game->soundLevel[sourceY][sourceX] = (unsigned char)loudness;
+    queueX[tail] = (unsigned char)sourceX;
+    queueY[tail] = (unsigned char)sourceY;
+    tail = (tail + 1) % size;
+
+    static const int stepX[4] = { 1, -1, 0, 0 }, stepY[4] = { 0, 0, 1, -1 };
+    while (head != tail) {
+        int x = queueX[head], y = queueY[head];
+        head = (head + 1) % size;
+        int level = game->soundLevel[y][x];
+        for (int d = 0; d < 4; ++d) {
+            int nx = x + stepX[d], ny = y + stepY[d];
+            if (nx < 0 || nx >= g_mapWidth || ny < 0 || ny >= g_mapHeight) continue;
+            char cell = g_map[ny][nx];
+            if (cell == '#' || cell == PORTAL_CELL) continue; // Sound does not follow portals
+            int next = level - 1;
+            if (cell == 'D') {
+                const Door* door = findDoor(game, nx, ny);
+                if (door) next -= (int)(SOUND_DOOR_LOSS * (1.0f - door->open) + 0.5f);
+            }
+            if (next <= 0) continue;
+            if (game->alertStamp[ny][nx] == generation && game->soundLevel[ny][nx] >= next) continue;
+            game->alertStamp[ny][nx] = generation;
+            game->soundLevel[ny][nx] = (unsigned char)next;
+            if ((tail + 1) % size == head) continue; // Full; the cell keeps its stamp
+            queueX[tail] = (unsigned char)nx;
+            queueY[tail] = (unsigned char)ny;
+            tail = (tail + 1) % size;
+        }
+    }
+}
+
+// --- Depth Bounds ---
+// Min/max wall depth over 8, 32 and 128 column tiles, rebuilt after the wall pass. A range
+// query picks the finest level where the range spans at most two tiles, so a sprite learns in
+// O(1) per level whether walls hide all of it (skip it) or none of it (skip column tests).
+// Tile bounds are conservative: a tile covering extra columns only widens min/max.
+#define DEPTH_BOUND_LEVELS 3
+#define DEPTH_BOUND_FINE_SHIFT 3    // 8 columns per finest tile
+#define DEPTH_BOUND_LEVEL_SHIFT 2   // Each level groups 4 tiles of the one below
+
+typedef struct {
+    float* minDepth[DEPTH_BOUND_LEVELS];
+    float* maxDepth[DEPTH_BOUND_LEVELS];
+    int numTiles[DEPTH_BOUND_LEVELS];
+} DepthBounds;
+
+// --- Frame Targets ---
+// The world renderer draws into a FrameTarget, so the same raycaster fills the terminal
+// buffers or an offline frame of any size. Depth data beyond zBuffer is per-frame scratch.
+typedef struct {
+    int width, height;
+    char* chars;        // width * height glyphs, row-major
+    char* colors;       // width * height color indices (0-6, see the display builder)
+    float* zBuffer;     // Wall depth per column
+    float* depth;       // Per-pixel depth: walls and see-through layers, overwritten by sprites/particles
+    DepthBounds bounds;
+    int horizon;              // Row level with the eye: height / 2, sheared by the pitch
+    float eyeHeight;          // Eye above the floor, in wall heights (0.5 = halfway up)
+    const char* floorGlyphs;  // Floor/ceiling glyphs for that horizon and eye, [y * 4 + (x & 3)]
+    const float* floorInvDepth; // 1 / distance to the floor/ceiling on each row
+} FrameTarget;
+
+// Sizes the bounds for `t` before the frame's jobs run. Returns -1 if the arena runs out
+int allocDepthBounds(FrameTarget* t, FrameArena* arena) {
+    DepthBounds* db = &t->bounds;
+    int group = 1 << DEPTH_BOUND_LEVEL_SHIFT;
+    for (int level = 0; level < DEPTH_BOUND_LEVELS; ++level) {
+        db->numTiles[level] = level == 0 ? (t->width + (1 << DEPTH_BOUND_FINE_SHIFT) - 1) >> DEPTH_BOUND_FINE_SHIFT
+                                         : (db->numTiles[level - 1] + group - 1) / group;
+        db->minDepth[level] = arenaAlloc(arena, db->numTiles[level] * sizeof(float));
+        db->maxDepth[level] = arenaAlloc(arena, db->numTiles[level] * sizeof(float));
+        if (!db->minDepth[level] || !db->maxDepth[level]) return -1;
+    }
+    return 0;
+}
+
+// Fills the bounds from the wall depths once every column is cast
+void buildDepthBounds(FrameTarget* t) {
+    DepthBounds* db = &t->bounds;
+    int group = 1 << DEPTH_BOUND_LEVEL_SHIFT;
+    for (int tile = 0; tile < db->numTiles[0]; ++tile) {
+        int start = tile << DEPTH_BOUND_FINE_SHIFT;
+        int end = start + (1 << DEPTH_BOUND_FINE_SHIFT);
+        if (end > t->width) end = t->width;
+        float lo = t->zBuffer[start], hi = t->zBuffer[start];
+        for (int x = start + 1; x < end; ++x) {
+            if (t->zBuffer[x] < lo) lo = t->zBuffer[x];
+            if (t->zBuffer[x] > hi) hi = t->zBuffer[x];
+        }
+        db->minDepth[0][tile] = lo;
+        db->maxDepth[0][tile] = hi;
+    }
+    for (int level = 1; level < DEPTH_BOUND_LEVELS; ++level) {
+        int childTiles = db->numTiles[level - 1];
+        for (int tile = 0; tile < db->numTiles[level]; ++tile) {
+            int first = tile * group;
+            float lo = db->minDepth[level - 1][first], hi = db->maxDepth[level - 1][first];
+            for (int c = first + 1; c < first + group && c < childTiles; ++c) {
+                if (db->minDepth[level - 1][c] < lo) lo = db->minDepth[level - 1][c];
+                if (db->maxDepth[level - 1][c] > hi) hi = db->maxDepth[level - 1][c];
+            }
+            db->minDepth[level][tile] = lo;
+            db->maxDepth[level][tile] = hi;
+        }
+    }
+}
 
-// --- Game Object Structure ---
-typedef enum {
-    OBJ_HEALTH,
-    OBJ_AMMO,
-    OBJ_ENEMY,
-} ObjectType;
+// Conservative wall depth bounds over columns [x0, x1), which must be on screen and non-empty.
+// Past the coarsest level (targets wider than 128 columns) the query scans its tiles.
+void queryDepthBounds(const DepthBounds* db, int x0, int x1, float* minOut, float* maxOut) {
+    int level = 0;
+    int shift = DEPTH_BOUND_FINE_SHIFT;
+    while (level < DEPTH_BOUND_LEVELS - 1 && ((x1 - 1) >> shift) - (x0 >> shift) > 1) {
+        level++;
+        shift += DEPTH_BOUND_LEVEL_SHIFT;
+    }
+    int first = x0 >> shift, last = (x1 - 1) >> shift;
+    float lo = db->minDepth[level][first], hi = db->maxDepth[level][first];
+    for (int tile = first + 1; tile <= last; ++tile) {
+        if (db->minDepth[level][tile] < lo) lo = db->minDepth[level][tile];
+        if (db->maxDepth[level][tile] > hi) hi = db->maxDepth[level][tile];
+    }
+    *minOut = lo;
+    *maxOut = hi;
+}
+
+// --- Sprite Rendering ---
+// Sprites are projected once into a list of screen-space instances, then drawn against a
+// per-pixel depth buffer that starts at the wall depth of each column. Transparent pixels
+// leave the buffer untouched, so overlapping sprites composite correctly in any order, and
+// each band of rows can be drawn independently of the others.
+#define SPRITE_BAND_ROWS 8
 
 typedef struct {
-    float x, y;
-    char displayChar;
-    const char* color; // This is not strictly used in the new rendering, `color` in g_colorBuffer is
-    ObjectType type;
-    int active;
-    int health;
-} GameObject;
+    const char* scaled;       // Column-major glyphs, or NULL to sample `frame` directly
+    const AtlasFrame* frame;
+    float depth;
+    int startX, startY;       // Unclipped top-left corner
+    int width, height;
+    int drawStartX, drawEndX; // Columns clipped to the screen
+    int fullyVisible;         // In front of the walls in every column it covers
+    char color;
+} SpriteInstance;
 
-#define MAX_GAME_OBJECTS 10
-GameObject g_gameObjects[MAX_GAME_OBJECTS];
+// Projects every active object; returns the number of on-screen instances written to `out`
+int projectSprites(const GameSession* game, const FrameTarget* t, SpriteInstance* out) {
+    int count = 0;
+    double dirX = sin(game->player.angle), dirY = cos(game->player.angle);
 
-int g_numGameObjects = 0;
+    for (int i = 0; i < game->numObjects; ++i) {
+        const GameObject* obj = &game->objects[i];
+        if (!obj->active) continue;
 
-// --- Door State ---
-typedef struct {
-    int mapX, mapY;
-    int isOpen;
-} Door;
+        // Transform into camera space using the same basis as the wall rays:
+        // forward = (sin, cos), camera plane = (cos, -sin), cameraX in [-1, 1] across the screen
+        double spriteX = obj->x - game->player.x;
+        double spriteY = obj->y - game->player.y;
+        double depth = spriteX * dirX + spriteY * dirY; // Perpendicular distance, as in g_zBuffer
+        if (depth < 0.1 || depth >= MAX_RENDER_DISTANCE) continue;
+        double cameraX = (spriteX * dirY - spriteY * dirX) / depth;
+        if (cameraX < -1.5 || cameraX > 1.5) continue; // Well outside the view
+        double screenX = (cameraX + 1.0) * t->width / 2.0;
 
-#define MAX_DOORS 5
-Door g_doors[MAX_DOORS];
-int g_numDoors = 0;
+        SpriteInstance* inst = &out[count];
+        inst->depth = depth;
+        inst->height = (int)(t->height / depth); // Size scales with distance
 
-// --- Display Buffers ---
-// Main screen buffer
-char g_screenBuffer[SCREEN_HEIGHT][SCREEN_WIDTH + 1];
-// Color buffer to store color codes for each position (index 0-6 corresponding to colors)
-char g_colorBuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
-// Complete display buffer including HUD
-char g_displayBuffer[TOTAL_DISPLAY_HEIGHT][TOTAL_LINE_BUFFER_SIZE];
-// Z-buffer for depth testing
-float g_zBuffer[SCREEN_WIDTH];
+        inst->color = 0; // Set color based on object type
+        if (obj->type == OBJ_HEALTH) inst->color = 4; // Green
+        else if (obj->type == OBJ_AMMO) inst->color = 5; // Yellow
+        else if (obj->type == OBJ_ENEMY) inst->color = 6; // Red
 
-// Previous frame buffer for comparison (reduces flicker)
-char g_prevDisplayBuffer[TOTAL_DISPLAY_HEIGHT][TOTAL_LINE_BUFFER_SIZE];
-int g_firstFrame = 1;
+        int frameId = -1;
+        SpriteLod lod = selectSpriteLod(inst->height);
+        if (lod == SPRITE_LOD_MARKER) {
+            // One cell at the sprite's center, whatever its projected size
+            inst->scaled = &obj->displayChar;
+            inst->frame = NULL;
+            inst->startX = (int)screenX;
+            inst->startY = t->horizon + (int)(inst->height * (t->eyeHeight - 0.5f)); // Half way up
+            inst->width = 1;
+            inst->height = 1;
+        } else {
+            const SpriteDef* def = &g_spriteDefs[obj->sprite];
+            int facing = selectSpriteFacing(def->numFacings, obj->heading, spriteX, spriteY);
+            frameId = spriteFrameId(obj->sprite, lod, facing);
+            inst->frame = &g_spriteAtlas.frames[frameId];
+            inst->scaled = NULL; // Fetched from the cache once the sprite is known to be visible
+            inst->width = scaledSpriteWidth(inst->frame, inst->height);
+            inst->startX = (int)(screenX - inst->width / 2);
+            inst->startY = t->horizon - (int)(inst->height * (1.0f - t->eyeHeight));
+        }
 
-// --- Non-blocking input globals (Linux specific) ---
-#ifndef _WIN32
-static struct termios g_oldTermios;
+        inst->drawStartX = inst->startX < 0 ? 0 : inst->startX;
+        inst->drawEndX = inst->startX + inst->width;
+        if (inst->drawEndX > t->width) inst->drawEndX = t->width;
+        if (inst->drawStartX >= inst->drawEndX) continue;
 
-void setupNonBlockingInput() {
-    struct termios newTermios;
-    tcgetattr(STDIN_FILENO, &g_oldTermios);
-    newTermios = g_oldTermios;
-    newTermios.c_lflag &= ~(ICANON | ECHO);
-    newTermios.c_cc[VMIN] = 0;
-    newTermios.c_cc[VTIME] = 0;
-    tcsetattr(STDIN_FILENO, TCSANOW, &newTermios);
+        float wallMin, wallMax;
+        queryDepthBounds(&t->bounds, inst->drawStartX, inst->drawEndX, &wallMin, &wallMax);
+        if (inst->depth >= wallMax) continue; // Behind the walls across its whole width
+        inst->fullyVisible = inst->depth < wallMin;
 
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+        if (frameId >= 0) {
+            int width;
+            inst->scaled = getScaledSprite(frameId, inst->height, &width);
+        }
+        count++;
+    }
+    return count;
 }
 
-void restoreBlockingInput() {
-    tcsetattr(STDIN_FILENO, TCSANOW, &g_oldTermios);
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
-}
+// Draws the rows [bandStart, bandEnd) of every sprite instance
+void drawSpriteBand(FrameTarget* t, const SpriteInstance* sprites, int numSprites, int bandStart, int bandEnd) {
+    for (int s = 0; s < numSprites; ++s) {
+        const SpriteInstance* inst = &sprites[s];
+        int drawStart_Y = inst->startY > bandStart ? inst->startY : bandStart;
+        int drawEnd_Y = inst->startY + inst->height < bandEnd ? inst->startY + inst->height : bandEnd;
+        if (drawStart_Y >= drawEnd_Y) continue;
 
-int getch_linux() {
-    char buf = 0;
-    if (read(STDIN_FILENO, &buf, 1) > 0) {
-        return buf;
+        // Draw sprite column by column
+        for (int stripe = inst->drawStartX; stripe < inst->drawEndX; ++stripe) {
+            if (!inst->fullyVisible && inst->depth >= t->zBuffer[stripe]) continue; // Behind the wall in this column
+            int texX = stripe - inst->startX;
+            const char* column = NULL;
+            const char* atlasColumn = NULL;
+            if (inst->scaled) {
+                column = inst->scaled + texX * inst->height + (drawStart_Y - inst->startY);
+            } else {
+                // Too tall for the cache: sample the atlas directly
+                atlasColumn = g_spriteAtlas.pixels + inst->frame->offset + texX * inst->frame->width / inst->width;
+            }
+            for (int y = drawStart_Y; y < drawEnd_Y; ++y) {
+                char glyph = column ? *column++
+                                    : atlasColumn[((y - inst->startY) * inst->frame->height / inst->height) * inst->frame->width];
+                int pixel = y * t->width + stripe;
+                if (glyph == ' ' || inst->depth >= t->depth[pixel]) continue; // Transparent or hidden
+                t->chars[pixel] = glyph;
+                t->colors[pixel] = inst->color;
+                t->depth[pixel] = inst->depth;
+            }
+        }
     }
-    return EOF;
 }
 
-int kbhit_linux() {
-    char buf = 0;
-    int bytesRead = read(STDIN_FILENO, &buf, 1);
-    if (bytesRead > 0) {
-        ungetc(buf, stdin);
-        return 1;
+// --- Particles ---
+typedef struct {
+    float speed, upSpeed, gravity, life;
+    char glyph, fadeGlyph; // Fresh / last third of life
+    char color;
+} ParticleStyle;
+
+const ParticleStyle g_particleStyles[NUM_PARTICLE_KINDS] = {
+    [PARTICLE_SPARK] = { 3.0f, 1.5f, -4.0f, 0.35f, '*', '.', 5 }, // Yellow
+    [PARTICLE_BLOOD] = { 1.5f, 1.0f, -3.0f, 0.80f, '%', ',', 6 }, // Red
+    [PARTICLE_SMOKE] = { 0.3f, 0.1f, 0.4f, 1.20f, 'o', '.', 3 },  // Light Gray
+};
+
+// Uniform in [-1, 1)
+float particleRandom(ParticleSystem* ps) {
+    ps->rng ^= ps->rng << 13;
+    ps->rng ^= ps->rng >> 17;
+    ps->rng ^= ps->rng << 5;
+    return (ps->rng >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+void spawnParticleBurst(ParticleSystem* ps, ParticleKind kind, float x, float y, float z, int count) {
+    const ParticleStyle* style = &g_particleStyles[kind];
+    for (int n = 0; n < count; ++n) {
+        unsigned int i = ps->head;
+        ps->head = (ps->head + 1) & (ps->capacity - 1);
+        if (ps->used < ps->capacity) ps->used++;
+
+        ps->x[i] = x;
+        ps->y[i] = y;
+        ps->z[i] = z;
+        ps->vx[i] = particleRandom(ps) * style->speed;
+        ps->vy[i] = particleRandom(ps) * style->speed;
+        ps->vz[i] = (particleRandom(ps) + 1.0f) * 0.5f * style->upSpeed;
+        ps->gravity[i] = style->gravity;
+        ps->life[i] = style->life * (0.6f + 0.4f * particleRandom(ps));
+        ps->kind[i] = (unsigned char)kind;
+        if (ps->life[i] > ps->longestLife) ps->longestLife = ps->life[i];
     }
-    return 0;
 }
-#endif
 
-// --- Improved screen management ---
-void initializeDisplay() {
-    // Clear screen once at startup and hide cursor
-    printf(ANSI_CLEAR_SCREEN ANSI_CURSOR_HOME ANSI_HIDE_CURSOR);
-    fflush(stdout);
+// Integrates every written slot; dead ones keep integrating harmlessly, which keeps the loop
+// branch-free. Particles stop at the floor.
+void updateParticles(ParticleSystem* ps, float dt) {
+    // Once the last burst has died out the ring is empty again; stop integrating
+    // (decaying velocities would otherwise sink into slow denormals)
+    ps->longestLife -= dt;
+    if (ps->longestLife <= 0.0f) {
+        ps->head = 0;
+        ps->used = 0;
+        ps->longestLife = 0.0f;
+        return;
+    }
+    int count = (ps->used + 3) & ~3;
+    float drag = 1.0f - PARTICLE_AIR_DRAG * dt;
+#if defined(__GNUC__)
+    const v4sf vdt = { dt, dt, dt, dt };
+    const v4sf vdrag = { drag, drag, drag, drag };
+    const v4sf zero = { 0, 0, 0, 0 };
+    for (int i = 0; i < count; i += 4) {
+        v4sf* x = (v4sf*)&ps->x[i];
+        v4sf* y = (v4sf*)&ps->y[i];
+        v4sf* z = (v4sf*)&ps->z[i];
+        v4sf* vx = (v4sf*)&ps->vx[i];
+        v4sf* vy = (v4sf*)&ps->vy[i];
+        v4sf* vz = (v4sf*)&ps->vz[i];
+        v4sf* life = (v4sf*)&ps->life[i];
+        *vz = (*vz + *(v4sf*)&ps->gravity[i] * vdt) * vdrag;
+        *vx *= vdrag;
+        *vy *= vdrag;
+        *x += *vx * vdt;
+        *y += *vy * vdt;
+        *z += *vz * vdt;
+        v4si belowFloor = *z < zero;
+        *z = (v4sf)((v4si)*z & ~belowFloor);
+        *vz = (v4sf)((v4si)*vz & ~belowFloor);
+        *life -= vdt;
+    }
+#else
+    for (int i = 0; i < count; ++i) {
+        ps->vz[i] = (ps->vz[i] + ps->gravity[i] * dt) * drag;
+        ps->vx[i] *= drag;
+        ps->vy[i] *= drag;
+        ps->x[i] += ps->vx[i] * dt;
+        ps->y[i] += ps->vy[i] * dt;
+        ps->z[i] += ps->vz[i] * dt;
+        if (ps->z[i] < 0.0f) {
+            ps->z[i] = 0.0f;
+            ps->vz[i] = 0.0f;
+        }
+        ps->life[i] -= dt;
+    }
+#endif
 }
 
-void finalizeDisplay() {
-    // Show cursor and reset colors
-    printf(ANSI_SHOW_CURSOR ANSI_COLOR_RESET);
-    fflush(stdout);
+// Projects live particles with the sprite camera basis and draws them as single cells
+void drawParticles(const GameSession* game, FrameTarget* t) {
+    const ParticleSystem* ps = &game->particles;
+    float dirX = sin(game->player.angle), dirY = cos(game->player.angle);
+    float px = game->player.x, py = game->player.y;
+    float nearestWall, farthestWall;
+    queryDepthBounds(&t->bounds, 0, t->width, &nearestWall, &farthestWall);
+
+    for (unsigned int i = 0; i < ps->used; ++i) {
+        if (ps->life[i] <= 0.0f) continue;
+        float dx = ps->x[i] - px;
+        float dy = ps->y[i] - py;
+        float depth = dx * dirX + dy * dirY;
+        if (depth < 0.1f || depth >= farthestWall) continue; // Behind every wall: skip projecting
+        float invDepth = 1.0f / depth;
+        float cameraX = (dx * dirY - dy * dirX) * invDepth;
+        if (cameraX < -1.0f || cameraX >= 1.0f) continue;
+        int col = (int)((cameraX + 1.0f) * (t->width / 2));
+        int row = (int)(t->horizon + (t->eyeHeight - ps->z[i]) * t->height * invDepth);
+        if (col < 0 || col >= t->width || row < 0 || row >= t->height) continue;
+        int pixel = row * t->width + col;
+        if (depth >= t->depth[pixel]) continue; // Behind a wall or sprite
+
+        const ParticleStyle* style = &g_particleStyles[ps->kind[i]];
+        t->chars[pixel] = ps->life[i] < style->life * 0.33f ? style->fadeGlyph : style->glyph;
+        t->colors[pixel] = style->color;
+        t->depth[pixel] = depth;
+    }
 }
 
-void updateDisplay() {
-    // Only update changed lines to reduce flicker
-    printf(ANSI_CURSOR_HOME); // Move cursor to top-left
-    
-    for (int y = 0; y < TOTAL_DISPLAY_HEIGHT; ++y) {
-        // Compare with previous frame
-        if (g_firstFrame || strcmp(g_displayBuffer[y], g_prevDisplayBuffer[y]) != 0) {
-            printf("\x1b[%d;1H", y + 1); // Move to specific line
-            printf("%s", g_displayBuffer[y]);
-            strcpy(g_prevDisplayBuffer[y], g_displayBuffer[y]); // Update previous buffer
+// --- Function to render the game world into a frame target ---
+// Draws column x for a wall at perpendicular distance perpWallDist: the wall slice shaded by
+// distance and colored by side (0 = x-side, 1 = y-side), then floor and ceiling, which between
+// them write every row
+void drawWallColumn(FrameTarget* t, int x, double perpWallDist, int side) {
+    int width = t->width, height = t->height;
+
+    // Ensure positive distance for perspective projection
+    if (perpWallDist < 0.01) perpWallDist = 0.01; // Avoid division by zero or negative distance
+
+    t->zBuffer[x] = perpWallDist; // Store depth for sprite rendering
+
+    int lineHeight = (int)(height / perpWallDist); // Correctly scaled line height
+
+    int drawStart = t->horizon - (int)(lineHeight * (1.0f - t->eyeHeight));
+    if (drawStart < 0) drawStart = 0;
+    int drawEnd = t->horizon + (int)(lineHeight * t->eyeHeight);
+    if (drawEnd >= height) drawEnd = height - 1;
+
+    char wallChars[4]; // By row & 3
+    char wallColor; // Use an integer index for color
+
+    if (perpWallDist < MAX_RENDER_DISTANCE) {
+        // Shade by distance, dithered between neighbouring glyphs
+        double position = wallRampPosition(perpWallDist);
+        for (int row = 0; row < 4; ++row) {
+            wallChars[row] = ditherRamp(g_wallRamp, 4, position, g_bayerThresholds[row][x & 3]);
+        }
+
+        // Assign color based on wall side
+        if (side == 1) { // Y-side wall
+            wallColor = 1; // Cyan
+        } else { // X-side wall
+            wallColor = 2; // Blue
         }
+    } else {
+        memset(wallChars, ' ', sizeof(wallChars)); // Beyond render distance, draw nothing
+        wallColor = 0;  // No specific color
+    }
+
+    // One pass down the column: ceiling, wall slice, floor. Every row also takes the wall's
+    // depth, since see-through layers and sprites may go in front of the floor too.
+    char* chars = t->chars + x;
+    char* colors = t->colors + x;
+    float* depth = t->depth + x;
+    float wallDepth = (float)perpWallDist;
+    const char* floorGlyphs = t->floorGlyphs + (x & 3); // Floor and ceiling are shaded by row
+    int y = 0;
+    for (; y < drawStart && y < height; ++y) { // Ceiling
+        chars[y * width] = floorGlyphs[y * 4];
+        colors[y * width] = 3; // Light Gray
+        depth[y * width] = wallDepth;
+    }
+    for (; y <= drawEnd; ++y) { // Wall slice
+        chars[y * width] = wallChars[y & 3];
+        colors[y * width] = wallColor;
+        depth[y * width] = wallDepth;
+    }
+    for (; y < height; ++y) { // Floor
+        chars[y * width] = floorGlyphs[y * 4];
+        colors[y * width] = 3; // Light Gray
+        depth[y * width] = wallDepth;
     }
-    
-    g_firstFrame = 0;
-    fflush(stdout);
 }
 
-// --- Initialize Game Objects and Doors from map ---
-void initializeGameElements() {
-    g_numGameObjects = 0;
-    g_numDoors = 0;
-    for (int y = 0; y < MAP_HEIGHT; ++y) {
-        for (int x = 0; x < MAP_WIDTH; ++x) {
-            if (g_map[y][x] == 'H') {
-                if (g_numGameObjects < MAX_GAME_OBJECTS) {
-                    g_gameObjects[g_numGameObjects] = (GameObject){.x = x + 0.5f, .y = y + 0.5f, .displayChar = '+', .color = ANSI_COLOR_GREEN, .type = OBJ_HEALTH, .active = 1, .health = 0};
-                    g_numGameObjects++;
-                }
-            } else if (g_map[y][x] == 'A') {
-                if (g_numGameObjects < MAX_GAME_OBJECTS) {
-                    g_gameObjects[g_numGameObjects] = (GameObject){.x = x + 0.5f, .y = y + 0.5f, .displayChar = '!', .color = ANSI_COLOR_YELLOW, .type = OBJ_AMMO, .active = 1, .health = 0};
-                    g_numGameObjects++;
-                }
-            } else if (g_map[y][x] == 'E') {
-                if (g_numGameObjects < MAX_GAME_OBJECTS) {
-                    g_gameObjects[g_numGameObjects] = (GameObject){.x = x + 0.5f, .y = y + 0.5f, .displayChar = 'M', .color = ANSI_COLOR_RED, .type = OBJ_ENEMY, .active = 1, .health = 50};
-                    g_numGameObjects++;
-                }
-            } else if (g_map[y][x] == 'D') {
-                if (g_numDoors < MAX_DOORS) {
-                    g_doors[g_numDoors] = (Door){.mapX = x, .mapY = y, .isOpen = 0};
-                    g_numDoors++;
-                }
-            }
-        }
+// --- See-through Walls ---
+// The grid raycaster records bars, fences and windows as layers and carries on, keeping up to
+// g_seeThroughLayers per column, nearest first. After the column's far wall is drawn, each
+// pixel takes the nearest layer that is solid there, so one pixel rarely looks at more than
+// one layer. A layer that is solid over its whole height (a bar, a post, a window frame) ends
+// the ray, and nothing behind it is cast.
+#define SEE_THROUGH_MAX_LAYERS 8
+
+int g_seeThroughLayers = 3; // Layers kept per column, at most SEE_THROUGH_MAX_LAYERS
+
+typedef struct {
+    double dist;
+    double wallX; // Where along the face the ray entered, 0..1
+    char cell;
+} SeeThroughLayer;
+
+// Whether a see-through cell is solid over the whole height of its face at `wallX`
+int seeThroughColumnSolid(char cell, double wallX) {
+    switch (cell) {
+        case '|': return wallX * 4.0 - floor(wallX * 4.0) < 0.3;  // Four bars per cell
+        case ':': return wallX * 5.0 - floor(wallX * 5.0) < 0.12; // Fence posts
+        default:  return wallX < 0.06 || wallX > 0.94;            // Window frame
     }
 }
 
-// --- Function to render the game world ---
-void render() {
-    // Clear Z-buffer and screen buffer
-    for (int i = 0; i < SCREEN_WIDTH; ++i) {
-        g_zBuffer[i] = MAX_RENDER_DISTANCE;
+// Glyph of a see-through cell at height `v` (0 = top .. 1 = bottom) of its face, or 0 where it
+// can be seen through. `x` and `y` place glass glints on the screen.
+char seeThroughGlyph(char cell, double v, int x, int y) {
+    switch (cell) {
+        case '|': return 0; // Bars are whole columns, see seeThroughColumnSolid()
+        case ':': return v * 8.0 - floor(v * 8.0) < 0.25 ? '+' : 0; // Wire mesh
+        default:  return v < 0.06 || v > 0.94 ? '=' : (x + y) % 9 == 0 ? '/' : 0;
     }
-    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-        for (int x = 0; x < SCREEN_WIDTH; ++x) {
-            g_screenBuffer[y][x] = ' ';
-            g_colorBuffer[y][x] = 0; // 0 = no color (reset)
+}
+
+char seeThroughColor(char cell) {
+    return cell == '"' ? 1 : 3; // Cyan glass, gray metal
+}
+
+// Overlays the layers, nearest first, on column `x` (already holding the far wall)
+void compositeSeeThrough(FrameTarget* t, int x, const SeeThroughLayer* layers, int numLayers) {
+    int width = t->width, height = t->height;
+    int spanStart[SEE_THROUGH_MAX_LAYERS + 1], spanEnd[SEE_THROUGH_MAX_LAYERS + 1];
+    int lineHeight[SEE_THROUGH_MAX_LAYERS + 1];
+    for (int i = 0; i < numLayers; ++i) {
+        double dist = layers[i].dist < 0.01 ? 0.01 : layers[i].dist;
+        lineHeight[i] = (int)(height / dist);
+        spanStart[i] = t->horizon - (int)(lineHeight[i] * (1.0f - t->eyeHeight));
+        spanEnd[i] = t->horizon + (int)(lineHeight[i] * t->eyeHeight);
+    }
+    // Farther layers only project inside nearer ones, so the first layer's rows hold them all
+    int firstRow = spanStart[0] < 0 ? 0 : spanStart[0];
+    int lastRow = spanEnd[0] >= height ? height - 1 : spanEnd[0];
+    for (int y = firstRow; y <= lastRow; ++y) {
+        for (int i = 0; i < numLayers && y >= spanStart[i] && y <= spanEnd[i]; ++i) {
+            char glyph = seeThroughColumnSolid(layers[i].cell, layers[i].wallX)
+                             ? (layers[i].cell == '"' ? '=' : '|')
+                             : seeThroughGlyph(layers[i].cell, (y - spanStart[i]) / (double)lineHeight[i], x, y);
+            if (!glyph) continue;
+            int pixel = y * width + x;
+            t->chars[pixel] = glyph;
+            t->colors[pixel] = seeThroughColor(layers[i].cell);
+            if (t->depth) t->depth[pixel] = (float)layers[i].dist;
+            break;
         }
-        g_screenBuffer[y][SCREEN_WIDTH] = '\0';
     }
+}
 
-    // --- Raycasting for Walls, Floor, and Ceiling ---
-    for (int x = 0; x < SCREEN_WIDTH; ++x) {
-        double cameraX = 2 * x / (double)SCREEN_WIDTH - 1;
-        double rayDirX = sin(g_player.angle) + cos(g_player.angle) * cameraX;
-        double rayDirY = cos(g_player.angle) - sin(g_player.angle) * cameraX;
+// Casts columns [firstX, lastX) through the grid. Portal hops are capped per ray and per band,
+// so facing portals cost at most PORTAL_HOPS_PER_COLUMN extra legs per column on average.
+#define PORTAL_MAX_DEPTH 4        // Hops one ray may take
+#define PORTAL_HOPS_PER_COLUMN 2  // Frame-wide hop budget, per column
+
+// Column x shows another place from `depth` on; sprites on this side stop at the portal's face
+void clampColumnDepth(FrameTarget* t, int x, float depth) {
+    if (t->zBuffer[x] > depth) t->zBuffer[x] = depth;
+    for (int y = 0; t->depth && y < t->height; ++y) {
+        if (t->depth[y * t->width + x] > depth) t->depth[y * t->width + x] = depth;
+    }
+}
+
+void castWallColumns(const GameSession* game, FrameTarget* t, int firstX, int lastX) {
+    int width = t->width;
+    // This band's share of the frame's portal hops, spread evenly over its columns
+    int hopBudget = PORTAL_HOPS_PER_COLUMN * (lastX - firstX);
+    double dirX = sin(game->player.angle), dirY = cos(game->player.angle);
 
-        int mapX = (int)g_player.x;
-        int mapY = (int)g_player.y;
+    // --- Raycasting for Walls, Floor, and Ceiling ---
+    for (int x = firstX; x < lastX; ++x) {
+        double cameraX = 2 * x / (double)width - 1;
+        double rayDirX = dirX + dirY * cameraX;
+        double rayDirY = dirY - dirX * cameraX;
 
-        double sideDistX;
-        double sideDistY;
+        // A ray runs in legs: each portal it enters starts a new one from the target cell
+        double originX = game->player.x, originY = game->player.y;
+        double traveled = 0.0; // Ray length covered by earlier legs
+        double portalDist = -1.0; // To the first portal entered, -1 = none
+        int hopsLeft = hopBudget / (lastX - x);
+        if (hopsLeft > PORTAL_MAX_DEPTH) hopsLeft = PORTAL_MAX_DEPTH;
 
-        double deltaDistX = (rayDirX == 0) ? 1e30 : fabs(1 / rayDirX);
-        double deltaDistY = (rayDirY == 0) ? 1e30 : fabs(1 / rayDirY);
+        int mapX = (int)game->player.x;
+        int mapY = (int)game->player.y;
 
         double perpWallDist = 0;
+        int side = -1;
+        SeeThroughLayer layers[SEE_THROUGH_MAX_LAYERS + 1];
+        int numLayers = 0;
 
-        int stepX;
-        int stepY;
+        for (;;) {
+            double sideDistX;
+            double sideDistY;
 
-        int hit = 0;
-        int side = -1;
+            double deltaDistX = (rayDirX == 0) ? 1e30 : fabs(1 / rayDirX);
+            double deltaDistY = (rayDirY == 0) ? 1e30 : fabs(1 / rayDirY);
 
-        if (rayDirX < 0) {
-            stepX = -1;
-            sideDistX = (g_player.x - mapX) * deltaDistX;
-        } else {
-            stepX = 1;
-            sideDistX = (mapX + 1.0 - g_player.x) * deltaDistX;
-        }
-        if (rayDirY < 0) {
-            stepY = -1;
-            sideDistY = (mapY + 1.0 - g_player.y) * deltaDistY;
-        } else {
-            stepY = 1;
-            sideDistY = (g_player.y - mapY) * deltaDistY;
-        }
+            int stepX;
+            int stepY;
+
+            int hit = 0;
+            double doorHitDist = -1.0;
+            const PortalDef* portal = NULL;
 
-        // Perform DDA
-        while (hit == 0 && perpWallDist < MAX_RENDER_DISTANCE) {
-            if (sideDistX < sideDistY) {
-                sideDistX += deltaDistX;
-                mapX += stepX;
-                side = 0;
+            // Distance along the ray to the first grid line it crosses on each axis, which is the
+            // cell's face on the side the ray is heading (stepping -1 reaches mapY, +1 mapY + 1)
+            if (rayDirX < 0) {
+                stepX = -1;
+                sideDistX = (originX - mapX) * deltaDistX;
+            } else {
+                stepX = 1;
+                sideDistX = (mapX + 1.0 - originX) * deltaDistX;
+            }
+            if (rayDirY < 0) {
+                stepY = -1;
+                sideDistY = (originY - mapY) * deltaDistY;
             } else {
-                sideDistY += deltaDistY;
-                mapY += stepY;
-                side = 1;
+                stepY = 1;
+                sideDistY = (mapY + 1.0 - originY) * deltaDistY;
             }
 
-            if (mapX >= 0 && mapX < MAP_WIDTH && mapY >= 0 && mapY < MAP_HEIGHT) {
-                char cell = g_map[mapY][mapX];
-                if (cell == '#') {
-                    hit = 1;
-                } else if (cell == 'D') {
-                    int isDoorClosed = 0;
-                    for (int i = 0; i < g_numDoors; ++i) {
-                        if (g_doors[i].mapX == mapX && g_doors[i].mapY == mapY && !g_doors[i].isOpen) {
-                            isDoorClosed = 1;
-                            break;
-                        }
-                    }
-                    if (isDoorClosed) {
+            // Perform DDA
+            while (hit == 0 && perpWallDist < MAX_RENDER_DISTANCE) {
+                if (sideDistX < sideDistY) {
+                    sideDistX += deltaDistX;
+                    mapX += stepX;
+                    side = 0;
+                } else {
+                    sideDistY += deltaDistY;
+                    mapY += stepY;
+                    side = 1;
+                }
+
+                if (mapX >= 0 && mapX < g_mapWidth && mapY >= 0 && mapY < g_mapHeight) {
+                    char cell = g_map[mapY][mapX];
+                    if (cell == '#') {
                         hit = 1;
+                    } else if (cell == PORTAL_CELL) {
+                        hit = 1; // A plain wall once the ray is out of hops
+                        if (hopsLeft > 0) portal = findPortal(mapX, mapY);
+                    } else if (isSeeThroughCell(cell)) {
+                        double dist = side == 0 ? sideDistX - deltaDistX : sideDistY - deltaDistY; // To the face entered
+                        double wallX = side == 0 ? originY + dist * rayDirY : originX + dist * rayDirX;
+                        wallX -= floor(wallX);
+                        int solid = seeThroughColumnSolid(cell, wallX);
+                        if (solid || numLayers < g_seeThroughLayers) {
+                            layers[numLayers++] = (SeeThroughLayer){ traveled + dist, wallX, cell };
+                        }
+                        if (solid) hit = 1;
+                    } else if (cell == 'D') {
+                        // The panel sits mid-cell; rays through the open part carry on
+                        const Door* door = findDoor(game, mapX, mapY);
+                        double doorDist = door ? intersectDoor(door, originX, originY, rayDirX, rayDirY) : -1.0;
+                        if (doorDist >= 0.0) {
+                            hit = 1;
+                            doorHitDist = doorDist;
+                            side = door->alongX ? 1 : 0;
+                        }
                     }
+                } else {
+                    // Ray went out of bounds, treat as hit at max distance
+                    hit = 1;
+                    perpWallDist = MAX_RENDER_DISTANCE; // Ensure it's beyond render distance
                 }
+            }
+
+            // Calculate perpendicular distance to wall
+            if (doorHitDist >= 0.0) {
+                perpWallDist = doorHitDist;
+            } else if (side == 0) {
+                perpWallDist = (mapX - originX + (1 - stepX) / 2) / rayDirX;
             } else {
-                // Ray went out of bounds, treat as hit at max distance
-                hit = 1;
-                perpWallDist = MAX_RENDER_DISTANCE; // Ensure it's beyond render distance
+                perpWallDist = (mapY - originY + (1 - stepY) / 2) / rayDirY;
             }
-        }
-        
-        // Calculate perpendicular distance to wall
-        if (side == 0) {
-            perpWallDist = (mapX - g_player.x + (1 - stepX) / 2) / rayDirX;
-        } else {
-            perpWallDist = (mapY - g_player.y + (1 - stepY) / 2) / rayDirY;
+            perpWallDist += traveled;
+            if (!portal || perpWallDist >= MAX_RENDER_DISTANCE) break;
+
+            // Carry on from the matching point of the target cell
+            if (portalDist < 0.0) portalDist = perpWallDist;
+            originX += (perpWallDist - traveled) * rayDirX;
+            originY += (perpWallDist - traveled) * rayDirY;
+            passThroughPortal(portal, &originX, &originY);
+            turnThroughPortal(portal, &rayDirX, &rayDirY);
+            traveled = perpWallDist;
+            mapX = portal->targetX;
+            mapY = portal->targetY;
+            hopsLeft--;
+            hopBudget--;
         }
 
-        // Ensure positive distance for perspective projection
-        if (perpWallDist < 0.01) perpWallDist = 0.01; // Avoid division by zero or negative distance
+        drawWallColumn(t, x, perpWallDist, side);
+        if (numLayers > 0) compositeSeeThrough(t, x, layers, numLayers);
+        if (portalDist >= 0.0) clampColumnDepth(t, x, portalDist);
+    }
+}
 
-        g_zBuffer[x] = perpWallDist; // Store depth for sprite rendering
+// --- Sector Rendering ---
+// Front to back through portals. Each sector is drawn into a window of columns: a ray leaving
+// the (convex) sector crosses exactly one of its walls after the point where it came in. A solid
+// wall finishes the column; a run of columns leaving through the same portal becomes the
+// window into the next sector. Only sectors that can be seen are ever visited.
+#define SECTOR_SPAN_COLUMNS 64 // Columns traversed together
+#define SECTOR_MAX_DEPTH 256   // Portal recursion guard
 
-        int lineHeight = (int)(SCREEN_HEIGHT / perpWallDist); // Correctly scaled line height
+typedef struct {
+    const GameSession* game;
+    const SectorMap* map;
+    FrameTarget* t;
+    int firstX;                              // Column of slot 0 below
+    double enterDist[SECTOR_SPAN_COLUMNS];   // Where each ray entered the current sector
+    unsigned char done[SECTOR_SPAN_COLUMNS];
+} SectorCast;
 
-        int drawStart = -lineHeight / 2 + SCREEN_HEIGHT / 2;
-        if (drawStart < 0) drawStart = 0;
-        int drawEnd = lineHeight / 2 + SCREEN_HEIGHT / 2;
-        if (drawEnd >= SCREEN_HEIGHT) drawEnd = SCREEN_HEIGHT - 1;
+void columnRay(const GameSession* game, int width, int x, double* rayDirX, double* rayDirY) {
+    double cameraX = 2 * x / (double)width - 1;
+    *rayDirX = sin(game->player.angle) + cos(game->player.angle) * cameraX;
+    *rayDirY = cos(game->player.angle) - sin(game->player.angle) * cameraX;
+}
 
-        char wallChar;
-        char wallColor; // Use an integer index for color
+// Distance along the ray to the segment, or -1 if it misses (endpoints count as hits)
+double intersectSegment(const MapVertex* a, const MapVertex* b, double originX, double originY, double rayDirX, double rayDirY) {
+    double edgeX = b->x - a->x, edgeY = b->y - a->y;
+    double denom = rayDirX * edgeY - rayDirY * edgeX;
+    if (fabs(denom) < 1e-12) return -1.0;
+    double toX = a->x - originX, toY = a->y - originY;
+    double dist = (toX * edgeY - toY * edgeX) / denom;
+    double along = (toX * rayDirY - toY * rayDirX) / denom;
+    if (along < -1e-9 || along > 1.0 + 1e-9) return -1.0;
+    return dist;
+}
 
-        if (perpWallDist < MAX_RENDER_DISTANCE) {
-            // Adjust character based on distance for pseudo-shading
-            if (perpWallDist < 3.0f) {
-                wallChar = '#';
-            } else if (perpWallDist < 6.0f) {
-                wallChar = '=';
-            } else if (perpWallDist < 9.0f) {
-                wallChar = '-';
-            } else {
-                wallChar = '.';
-            }
+void drawSectorWindow(SectorCast* cast, int sectorIndex, int x0, int x1, int depth) {
+    const GameSession* game = cast->game;
+    const Sector* sector = &cast->map->sectors[sectorIndex];
+    int width = cast->t->width;
+    double px = game->player.x, py = game->player.y;
+
+    // A door's panel sits inside its sector, in front of the sector's own walls
+    const Door* door = sector->doorX >= 0 ? findDoor(game, sector->doorX, sector->doorY) : NULL;
+    for (int x = x0; door && x < x1; ++x) {
+        int slot = x - cast->firstX;
+        if (cast->done[slot]) continue;
+        double rayDirX, rayDirY;
+        columnRay(game, width, x, &rayDirX, &rayDirY);
+        double dist = intersectDoor(door, px, py, rayDirX, rayDirY);
+        if (dist > cast->enterDist[slot] + 1e-9) {
+            drawWallColumn(cast->t, x, dist, door->alongX ? 1 : 0);
+            cast->done[slot] = 1;
+        }
+    }
 
-            // Assign color based on wall side
-            if (side == 1) { // Y-side wall
-                wallColor = 1; // Cyan
-            } else { // X-side wall
-                wallColor = 2; // Blue
+    // Any vertex average is inside a convex sector; it tells which way each wall faces
+    double centerX = 0.0, centerY = 0.0;
+    for (int w = 0; w < sector->numWalls; ++w) {
+        centerX += cast->map->vertices[cast->map->walls[sector->firstWall + w].v0].x;
+        centerY += cast->map->vertices[cast->map->walls[sector->firstWall + w].v0].y;
+    }
+    centerX /= sector->numWalls;
+    centerY /= sector->numWalls;
+
+    for (int w = 0; w < sector->numWalls; ++w) {
+        const SectorWall* wall = &cast->map->walls[sector->firstWall + w];
+        const MapVertex* a = &cast->map->vertices[wall->v0];
+        const MapVertex* b = &cast->map->vertices[wall->v1];
+        int side = fabsf(b->y - a->y) < fabsf(b->x - a->x) ? 1 : 0; // Runs along x: a y-side
+        double inside = (b->x - a->x) * (centerY - a->y) - (b->y - a->y) * (centerX - a->x);
+        int runStart = -1;
+        for (int x = x0; x <= x1; ++x) {
+            int exits = 0;
+            double dist = 0.0;
+            if (x < x1 && !cast->done[x - cast->firstX]) {
+                double rayDirX, rayDirY;
+                columnRay(game, width, x, &rayDirX, &rayDirY);
+                // Only a wall the ray crosses outwards can be its exit; this also holds when
+                // the eye sits exactly on a sector edge
+                double across = (b->x - a->x) * rayDirY - (b->y - a->y) * rayDirX;
+                if (across * inside < 0.0) {
+                    dist = intersectSegment(a, b, px, py, rayDirX, rayDirY);
+                    exits = dist >= cast->enterDist[x - cast->firstX] - 1e-6;
+                }
+            }
+            if (exits && wall->portal < 0) {
+                drawWallColumn(cast->t, x, dist, side);
+                cast->done[x - cast->firstX] = 1;
+            } else if (exits) {
+                cast->enterDist[x - cast->firstX] = dist;
+                if (runStart < 0) runStart = x;
+            } else if (runStart >= 0) {
+                // The run through this portal ended: it is the next sector's window
+                if (depth < SECTOR_MAX_DEPTH) drawSectorWindow(cast, wall->portal, runStart, x, depth + 1);
+                for (int r = runStart; r < x; ++r) {
+                    if (!cast->done[r - cast->firstX]) {
+                        drawWallColumn(cast->t, r, MAX_RENDER_DISTANCE, 0); // Lost ray: nothing visible
+                        cast->done[r - cast->firstX] = 1;
+                    }
+                }
+                runStart = -1;
             }
-        } else {
-            wallChar = ' '; // Beyond render distance, draw nothing
-            wallColor = 0;  // No specific color
         }
+    }
+}
 
-        // Draw the wall slice
-        for (int y = drawStart; y <= drawEnd; ++y) {
-            g_screenBuffer[y][x] = wallChar;
-            g_colorBuffer[y][x] = wallColor;
+// Casts columns [firstX, lastX) through the game's sector map
+void castSectorColumns(const GameSession* game, FrameTarget* t, int firstX, int lastX) {
+    int start = findSector(game->sectorMap, game->player.x, game->player.y);
+    if (start < 0) {
+        castWallColumns(game, t, firstX, lastX); // Player is inside solid space; the grid copes
+        return;
+    }
+    SectorCast cast = { .game = game, .map = game->sectorMap, .t = t };
+    for (cast.firstX = firstX; cast.firstX < lastX; cast.firstX += SECTOR_SPAN_COLUMNS) {
+        int spanEnd = cast.firstX + SECTOR_SPAN_COLUMNS < lastX ? cast.firstX + SECTOR_SPAN_COLUMNS : lastX;
+        memset(cast.done, 0, sizeof(cast.done));
+        memset(cast.enterDist, 0, sizeof(cast.enterDist));
+        drawSectorWindow(&cast, start, cast.firstX, spanEnd, 0);
+        for (int x = cast.firstX; x < spanEnd; ++x) {
+            if (!cast.done[x - cast.firstX]) drawWallColumn(t, x, MAX_RENDER_DISTANCE, 0);
         }
+    }
+}
 
-        // Floor and Ceiling (drawing from bottom/top of wall slice)
-        double playerHeight = SCREEN_HEIGHT / 2.0;
+// --- BSP Rendering ---
+// Walks the tree near side first, so walls arrive front to back and the first hit on a column
+// is final. Columns are done a 64-column span at a time with one coverage bit each; a wall whose
+// projected columns are already covered is skipped, and the walk stops once the span is full.
+#define BSP_SPAN_COLUMNS 64
+#define BSP_NEAR_PLANE 1e-4f
 
-        for (int y = drawEnd + 1; y < SCREEN_HEIGHT; ++y) { // Draw floor
-            double currentDist = playerHeight / (y - playerHeight);
-            if (currentDist < 0.01) currentDist = 0.01;
+typedef struct {
+    const GameSession* game;
+    const BspTree* tree;
+    FrameTarget* t;
+    int firstX, lastX;     // Span being cast
+    uint64_t covered, full; // Bit per column of the span
+    float forwardX, forwardY, planeX, planeY;
+} BspCast;
 
-            char floorChar;
-            if (currentDist < 2.0f) floorChar = '#';
-            else if (currentDist < 4.0f) floorChar = '=';
-            else if (currentDist < 6.0f) floorChar = '-';
-            else if (currentDist < 10.0f) floorChar = ',';
-            else floorChar = ' ';
+// Projects `seg` to the span's columns, clipped to the near plane; returns 0 if none are in view
+int projectBspSeg(const BspCast* cast, const BspSeg* seg, int* firstX, int* lastX) {
+    float px = cast->game->player.x, py = cast->game->player.y;
+    float depth0 = (seg->a.x - px) * cast->forwardX + (seg->a.y - py) * cast->forwardY;
+    float depth1 = (seg->b.x - px) * cast->forwardX + (seg->b.y - py) * cast->forwardY;
+    float lateral0 = (seg->a.x - px) * cast->planeX + (seg->a.y - py) * cast->planeY;
+    float lateral1 = (seg->b.x - px) * cast->planeX + (seg->b.y - py) * cast->planeY;
+    if (depth0 < BSP_NEAR_PLANE && depth1 < BSP_NEAR_PLANE) return 0;
+    if (depth0 < BSP_NEAR_PLANE) {
+        lateral0 += (lateral1 - lateral0) * (BSP_NEAR_PLANE - depth0) / (depth1 - depth0);
+        depth0 = BSP_NEAR_PLANE;
+    } else if (depth1 < BSP_NEAR_PLANE) {
+        lateral1 += (lateral0 - lateral1) * (BSP_NEAR_PLANE - depth1) / (depth0 - depth1);
+        depth1 = BSP_NEAR_PLANE;
+    }
+    float halfWidth = cast->t->width * 0.5f;
+    float screen0 = (lateral0 / depth0 + 1.0f) * halfWidth, screen1 = (lateral1 / depth1 + 1.0f) * halfWidth;
+    float low = screen0 < screen1 ? screen0 : screen1, high = screen0 < screen1 ? screen1 : screen0;
+    // A column's ray sits at its left edge; one column of slack covers rounding at the ends
+    *firstX = low - 1.0f > cast->firstX ? (int)(low - 1.0f) : cast->firstX;
+    *lastX = high + 1.0f < cast->lastX ? (int)(high + 1.0f) + 1 : cast->lastX;
+    return *firstX < *lastX;
+}
 
-            g_screenBuffer[y][x] = floorChar;
-            g_colorBuffer[y][x] = 3; // Light Gray
-        }
+void drawBspSeg(BspCast* cast, const BspSeg* seg) {
+    const GameSession* game = cast->game;
+    float px = game->player.x, py = game->player.y;
+    // Solid walls are one-sided: seen from behind (or edge on) they cannot be the first hit
+    if (seg->doorX < 0 && (seg->b.x - seg->a.x) * (py - seg->a.y) - (seg->b.y - seg->a.y) * (px - seg->a.x) <= 0.0f) return;
 
-        for (int y = drawStart - 1; y >= 0; --y) { // Draw ceiling
-            double currentDist = playerHeight / (playerHeight - y);
-            if (currentDist < 0.01) currentDist = 0.01;
+    int firstX, lastX;
+    if (!projectBspSeg(cast, seg, &firstX, &lastX)) return;
+    uint64_t mask = 0;
+    for (int x = firstX; x < lastX; ++x) mask |= 1ull << (x - cast->firstX);
+    if ((cast->covered & mask) == mask) return;
 
-            char ceilingChar;
-            if (currentDist < 2.0f) ceilingChar = '#';
-            else if (currentDist < 4.0f) ceilingChar = '=';
-            else if (currentDist < 6.0f) ceilingChar = '-';
-            else if (currentDist < 10.0f) ceilingChar = ',';
-            else ceilingChar = ' ';
+    const Door* door = seg->doorX >= 0 ? findDoor(game, seg->doorX, seg->doorY) : NULL;
+    int side = door ? door->alongX : fabsf(seg->b.y - seg->a.y) < fabsf(seg->b.x - seg->a.x) ? 1 : 0;
+    for (int x = firstX; x < lastX; ++x) {
+        uint64_t bit = 1ull << (x - cast->firstX);
+        if (cast->covered & bit) continue;
+        double rayDirX, rayDirY;
+        columnRay(game, cast->t->width, x, &rayDirX, &rayDirY);
+        double dist = intersectSegment(&seg->a, &seg->b, px, py, rayDirX, rayDirY);
+        if (dist > 0.0 && door) dist = intersectDoor(door, px, py, rayDirX, rayDirY); // Open part lets it through
+        if (dist <= 0.0) continue;
+        drawWallColumn(cast->t, x, dist, side);
+        cast->covered |= bit;
+    }
+}
+
+void drawBspNode(BspCast* cast, int index) {
+    if (index < 0 || cast->covered == cast->full) return;
+    const BspNode* node = &cast->tree->nodes[index];
+    int eyeInFront = bspSide(node, cast->game->player.x, cast->game->player.y) >= 0.0f;
+    drawBspNode(cast, eyeInFront ? node->front : node->back);
+    for (int i = 0; i < node->numSegs && cast->covered != cast->full; ++i) {
+        drawBspSeg(cast, &cast->tree->segs[node->firstSeg + i]);
+    }
+    drawBspNode(cast, eyeInFront ? node->back : node->front);
+}
 
-            g_screenBuffer[y][x] = ceilingChar;
-            g_colorBuffer[y][x] = 3; // Light Gray
+// Casts columns [firstX, lastX) through the game's BSP tree
+void castBspColumns(const GameSession* game, FrameTarget* t, int firstX, int lastX) {
+    BspCast cast = {
+        .game = game, .tree = game->bspTree, .t = t,
+        .forwardX = sinf(game->player.angle), .forwardY = cosf(game->player.angle),
+        .planeX = cosf(game->player.angle), .planeY = -sinf(game->player.angle),
+    };
+    for (cast.firstX = firstX; cast.firstX < lastX; cast.firstX += BSP_SPAN_COLUMNS) {
+        cast.lastX = cast.firstX + BSP_SPAN_COLUMNS < lastX ? cast.firstX + BSP_SPAN_COLUMNS : lastX;
+        int columns = cast.lastX - cast.firstX;
+        cast.full = columns == 64 ? ~0ull : (1ull << columns) - 1;
+        cast.covered = 0;
+        drawBspNode(&cast, game->bspTree->root);
+        for (int x = cast.firstX; x < cast.lastX; ++x) {
+            if (!(cast.covered & (1ull << (x - cast.firstX)))) drawWallColumn(t, x, MAX_RENDER_DISTANCE, 0);
         }
     }
+}
+
+// --- Edge Outlines ---
+// Optional pass (--outline) that draws outline glyphs where depth jumps, run after the sprites
+// and before the particles. It works on inverse depth, which is linear across any flat
+// surface on screen, so a 3x3 Laplacian (the 3x3 box sum less nine times the centre) reads
+// zero on walls, floors and ceilings and fires only at discontinuities, on their near side.
+// Only two kinds of region can hold one: columns where the wall depth jumps nearer (found
+// from the z-buffer alone) and the rectangles sprites were drawn in. The kernel runs over
+// those, four pixels at a time, on row sums built once per row (the box sum is separable);
+// pixels found to be edges take Sobel-like second differences to orient their glyph.
+#define OUTLINE_DEPTH_RATIO 0.15f // Drop in inverse depth, relative to the pixel's, that outlines it
+
+int g_outlineEdges = 0; // Set by --outline
+
+typedef struct {
+    float* inv;      // Inverse depth per pixel, filled in over the regions being outlined
+    float* rowSums;  // inv[x - 1] + inv[x] + inv[x + 1], likewise
+    float* wallInv;  // Inverse wall depth per column
+} OutlineScratch;
+
+// Fills inverse depth for row y, columns [x0, x1). Floor and ceiling pixels carry their
+// column's wall depth, so they take their row's floor depth where that is nearer.
+void buildInverseRow(const FrameTarget* t, const OutlineScratch* s, int y, int x0, int x1) {
+    const float* depth = t->depth + y * t->width;
+    float* inv = s->inv + y * t->width;
+    float floorInv = t->floorInvDepth[y];
+    int x = x0;
+#if defined(__GNUC__)
+    const v4sf one = { 1, 1, 1, 1 };
+    const v4sf vfloor = { floorInv, floorInv, floorInv, floorInv };
+    for (; x + 4 <= x1; x += 4) {
+        v4sf d;
+        memcpy(&d, depth + x, sizeof(d));
+        v4sf w = one / d;
+        v4si nearer = w > vfloor;
+        w = (v4sf)(((v4si)w & nearer) | ((v4si)vfloor & ~nearer));
+        memcpy(inv + x, &w, sizeof(w));
+    }
+#endif
+    for (; x < x1; ++x) {
+        float w = 1.0f / depth[x];
+        inv[x] = w > floorInv ? w : floorInv;
+    }
+}
+
+// Fills the 3-pixel row sums for row y, columns [x0, x1); inverse depth must cover x0 - 1 .. x1
+void buildRowSums(const FrameTarget* t, const OutlineScratch* s, int y, int x0, int x1) {
+    const float* inv = s->inv + y * t->width;
+    float* sums = s->rowSums + y * t->width;
+    int x = x0;
+#if defined(__GNUC__)
+    for (; x + 4 <= x1; x += 4) {
+        v4sf l, c, r;
+        memcpy(&l, inv + x - 1, sizeof(l));
+        memcpy(&c, inv + x, sizeof(c));
+        memcpy(&r, inv + x + 1, sizeof(r));
+        v4sf sum = l + c + r;
+        memcpy(sums + x, &sum, sizeof(sum));
+    }
+#endif
+    for (; x < x1; ++x) sums[x] = inv[x - 1] + inv[x] + inv[x + 1];
+}
+
+// Draws the outline glyph for the edge pixel at (x, y), oriented along the edge
+void outlineEdge(FrameTarget* t, const float* inv, int x, int y) {
+    int w = t->width;
+    const float* u = inv + (y - 1) * w + x;
+    const float* m = inv + y * w + x;
+    const float* d = inv + (y + 1) * w + x;
+    // [1 -2 1] across each axis, smoothed [1 2 1] along the other, and the slope across the edge
+    float lx = (u[-1] + 2.0f * m[-1] + d[-1]) + (u[1] + 2.0f * m[1] + d[1]) - 2.0f * (u[0] + 2.0f * m[0] + d[0]);
+    float ly = (u[-1] + 2.0f * u[0] + u[1]) + (d[-1] + 2.0f * d[0] + d[1]) - 2.0f * (m[-1] + 2.0f * m[0] + m[1]);
+    float gx = m[1] - m[-1], gy = d[0] - u[0];
+    float ax = fabsf(lx), ay = fabsf(ly);
+    char glyph = ax > 2.0f * ay ? '|' : ay > 2.0f * ax ? '-' : (gx > 0.0f) == (gy > 0.0f) ? '/' : '\\';
+    t->chars[y * w + x] = glyph;
+    t->colors[y * w + x] = 0;
+}
+
+// A straight edge puts 3 of the 9 pixels past the jump
+#define OUTLINE_LIMIT (9.0f - 3.0f * OUTLINE_DEPTH_RATIO)
 
-    // --- Render Game Objects (Sprites) ---
-    // Sort objects by distance (farthest to closest) for proper overdrawing without complex z-buffering
-    // (Though current Z-buffer handles this, sorting for sprites can sometimes simplify depth issues)
-    // The current Z-buffer is per-column, so closest-to-farthest for objects is often what you need for this.
-    // Your sort from closest to farthest, then use Z-buffer. This is fine.
-    for (int i = 0; i < g_numGameObjects - 1; ++i) {
-        for (int j = i + 1; j < g_numGameObjects; ++j) {
-            double distA = pow(g_player.x - g_gameObjects[i].x, 2) + pow(g_player.y - g_gameObjects[i].y, 2);
-            double distB = pow(g_player.x - g_gameObjects[j].x, 2) + pow(g_player.y - g_gameObjects[j].y, 2);
-            if (distA < distB) { // Sorts closest first
-                GameObject temp = g_gameObjects[i];
-                g_gameObjects[i] = g_gameObjects[j];
-                g_gameObjects[j] = temp;
+// Outlines the edges in columns [x0, x1), rows [y0, y1), clipped to the frame's interior
+void outlineRegion(FrameTarget* t, const OutlineScratch* s, int x0, int x1, int y0, int y1) {
+    int width = t->width;
+    if (x0 < 1) x0 = 1;
+    if (x1 > width - 1) x1 = width - 1;
+    if (y0 < 1) y0 = 1;
+    if (y1 > t->height - 1) y1 = t->height - 1;
+    if (x0 >= x1 || y0 >= y1) return;
+    for (int y = y0 - 1; y <= y1; ++y) {
+        buildInverseRow(t, s, y, x0 - 1, x1 + 1);
+        buildRowSums(t, s, y, x0, x1);
+    }
+    for (int y = y0; y < y1; ++y) {
+        const float* above = s->rowSums + (y - 1) * width;
+        const float* row = s->rowSums + y * width;
+        const float* below = s->rowSums + (y + 1) * width;
+        const float* centre = s->inv + y * width;
+        int x = x0;
+#if defined(__GNUC__)
+        const v4sf limit = { OUTLINE_LIMIT, OUTLINE_LIMIT, OUTLINE_LIMIT, OUTLINE_LIMIT };
+        for (; x + 4 <= x1; x += 4) {
+            v4sf a, r, b, c;
+            memcpy(&a, above + x, sizeof(a));
+            memcpy(&r, row + x, sizeof(r));
+            memcpy(&b, below + x, sizeof(b));
+            memcpy(&c, centre + x, sizeof(c));
+            v4si edge = a + r + b < limit * c;
+            if (!(edge[0] | edge[1] | edge[2] | edge[3])) continue;
+            for (int lane = 0; lane < 4; ++lane) {
+                if (edge[lane]) outlineEdge(t, s->inv, x + lane, y);
             }
         }
+#endif
+        for (; x < x1; ++x) {
+            if (above[x] + row[x] + below[x] < OUTLINE_LIMIT * centre[x]) outlineEdge(t, s->inv, x, y);
+        }
     }
+}
 
-    for (int i = 0; i < g_numGameObjects; ++i) {
-        if (!g_gameObjects[i].active) continue;
+// Outlines wall depth jumps and the sprites in `sprites`
+void drawOutlines(FrameTarget* t, const OutlineScratch* s, const SpriteInstance* sprites, int numSprites) {
+    int width = t->width;
+    for (int x = 0; x < width; ++x) s->wallInv[x] = 1.0f / t->zBuffer[x];
+    // Columns on the near side of a wall jump, the same test over a whole wall column; runs
+    // of them are outlined together
+    int runStart = -1;
+    for (int x = 1; x <= width - 1; ++x) {
+        const float* w = s->wallInv + x;
+        int jump = x < width - 1 && 3.0f * (w[-1] + w[0] + w[1]) < OUTLINE_LIMIT * w[0];
+        if (jump && runStart < 0) runStart = x;
+        if (!jump && runStart >= 0) {
+            outlineRegion(t, s, runStart, x, 1, t->height - 1);
+            runStart = -1;
+        }
+    }
+    for (int i = 0; i < numSprites; ++i) {
+        const SpriteInstance* inst = &sprites[i];
+        outlineRegion(t, s, inst->drawStartX - 1, inst->drawEndX + 1, inst->startY - 1, inst->startY + inst->height + 1);
+    }
+}
 
-        double spriteX = g_gameObjects[i].x - g_player.x;
-        double spriteY = g_gameObjects[i].y - g_player.y;
+// --- Scene Jobs ---
+// A frame is a small task graph: wall columns in bands, then depth bounds and sprite
+// projection, then sprite row bands (disjoint rows), then particles over the whole frame.
+#define SCENE_COLUMN_BAND 64 // Columns per wall job
 
-        // Calculate sprite angle relative to player's view
-        double spriteAngle = atan2(spriteY, spriteX);
-        double relativeAngle = spriteAngle - g_player.angle;
+typedef struct {
+    const GameSession* game;
+    FrameTarget* t;
+    SpriteInstance* sprites;
+    int numSprites;
+    OutlineScratch outline; // Buffers for the outline pass, when enabled
+} SceneJobs;
 
-        // Normalize relative angle to be within (-PI, PI]
-        while (relativeAngle > M_PI) relativeAngle -= 2 * M_PI;
-        while (relativeAngle <= -M_PI) relativeAngle += 2 * M_PI;
+void castWallsTask(void* ctx, int band) {
+    SceneJobs* scene = ctx;
+    int lastX = (band + 1) * SCENE_COLUMN_BAND;
+    if (lastX > scene->t->width) lastX = scene->t->width;
+    if (scene->game->bspTree) castBspColumns(scene->game, scene->t, band * SCENE_COLUMN_BAND, lastX);
+    else if (scene->game->sectorMap) castSectorColumns(scene->game, scene->t, band * SCENE_COLUMN_BAND, lastX);
+    else castWallColumns(scene->game, scene->t, band * SCENE_COLUMN_BAND, lastX);
+}
 
-        double distance = sqrt(spriteX * spriteX + spriteY * spriteY);
+void prepareSpritesTask(void* ctx, int unused) {
+    (void)unused;
+    SceneJobs* scene = ctx;
+    buildDepthBounds(scene->t);
+    scene->numSprites = projectSprites(scene->game, scene->t, scene->sprites);
+}
 
-        // Check if sprite is in FOV and within render distance
-        if (distance > 0.1 && fabs(relativeAngle) < FOV_RADIANS / 2.0 && distance < MAX_RENDER_DISTANCE) {
-            // Project sprite onto screen
-            // The 0.5 * FOV_RADIANS is the half FOV angle, mapping to half screen width
-            double screenX = (SCREEN_WIDTH / 2.0) + (relativeAngle / (FOV_RADIANS / 2.0)) * (SCREEN_WIDTH / 2.0);
+void spriteBandTask(void* ctx, int band) {
+    SceneJobs* scene = ctx;
+    FrameTarget* t = scene->t;
+    int firstRow = band * SPRITE_BAND_ROWS;
+    int lastRow = firstRow + SPRITE_BAND_ROWS < t->height ? firstRow + SPRITE_BAND_ROWS : t->height;
+    drawSpriteBand(t, scene->sprites, scene->numSprites, firstRow, lastRow);
+}
 
-            int spriteHeight = (int)(SCREEN_HEIGHT / distance); // Size scales with distance
-            int spriteWidth = (int)(spriteHeight * 0.75); // Aspect ratio approximation
+void particlesTask(void* ctx, int unused) {
+    (void)unused;
+    SceneJobs* scene = ctx;
+    drawParticles(scene->game, scene->t);
+}
 
-            int drawStart_Y = -spriteHeight / 2 + SCREEN_HEIGHT / 2;
-            if (drawStart_Y < 0) drawStart_Y = 0;
-            int drawEnd_Y = spriteHeight / 2 + SCREEN_HEIGHT / 2;
-            if (drawEnd_Y >= SCREEN_HEIGHT) drawEnd_Y = SCREEN_HEIGHT - 1;
+void outlineTask(void* ctx, int unused) {
+    (void)unused;
+    SceneJobs* scene = ctx;
+    drawOutlines(scene->t, &scene->outline, scene->sprites, scene->numSprites);
+}
 
-            int drawStart_X = (int)(screenX - spriteWidth / 2);
-            int drawEnd_X = (int)(screenX + spriteWidth / 2);
+// Adds the jobs that render `game` into `t`; returns the last one. Every frame buffer comes from
+// `arena` here, so the jobs never allocate; if it runs out the graph is marked failed and NULL returned.
+Job* addSceneJobs(JobGraph* graph, GameSession* game, FrameTarget* t, FrameArena* arena) {
+    SceneJobs* scene = arenaAlloc(arena, sizeof(SceneJobs));
+    if (!scene) {
+        graph->failed = 1;
+        return NULL;
+    }
+    scene->game = game;
+    scene->t = t;
+    scene->sprites = arenaAlloc(arena, (game->numObjects + 1) * sizeof(SpriteInstance));
+    scene->numSprites = 0;
+    memset(&scene->outline, 0, sizeof(scene->outline));
+    int missing = !scene->sprites;
+    if (g_outlineEdges) {
+        scene->outline.inv = arenaAlloc(arena, sizeof(float) * t->width * t->height);
+        scene->outline.rowSums = arenaAlloc(arena, sizeof(float) * t->width * t->height);
+        scene->outline.wallInv = arenaAlloc(arena, sizeof(float) * t->width);
+        missing |= !scene->outline.inv || !scene->outline.rowSums || !scene->outline.wallInv;
+    }
+    t->depth = arenaAlloc(arena, sizeof(float) * t->width * t->height);
+    missing |= !t->depth || allocDepthBounds(t, arena) != 0;
+    int shift = pitchShift(game->player.pitch, t->height);
+    t->horizon = t->height / 2 + shift;
+    t->eyeHeight = playerEyeHeight(&game->player);
+    ViewRows* rows = &game->viewRows;
+    ViewRows frameRows;
+    if (prepareViewRows(rows, t->height, shift, t->eyeHeight) != 0) {
+        // The cached rows stay for later frames; this one builds its own in the arena
+        frameRows = (ViewRows){ .invDepth = arenaAlloc(arena, sizeof(float) * t->height),
+                                .glyphs = arenaAlloc(arena, 4 * t->height), .capacity = t->height };
+        missing |= !frameRows.invDepth || !frameRows.glyphs;
+        if (!missing) prepareViewRows(&frameRows, t->height, shift, t->eyeHeight);
+        rows = &frameRows;
+    }
+    t->floorGlyphs = rows->glyphs;
+    t->floorInvDepth = rows->invDepth;
 
-            // Draw sprite column by column
-            for (int stripe = drawStart_X; stripe < drawEnd_X; ++stripe) {
-                if (stripe >= 0 && stripe < SCREEN_WIDTH && distance < g_zBuffer[stripe]) {
-                    // Only draw if within screen bounds and closer than current wall/object at this column
-                    for (int y = drawStart_Y; y <= drawEnd_Y; ++y) {
-                        if (y >= 0 && y < SCREEN_HEIGHT) {
-                            g_screenBuffer[y][stripe] = g_gameObjects[i].displayChar;
-                            // Set color based on object type
-                            if (g_gameObjects[i].type == OBJ_HEALTH) g_colorBuffer[y][stripe] = 4; // Green
-                            else if (g_gameObjects[i].type == OBJ_AMMO) g_colorBuffer[y][stripe] = 5; // Yellow
-                            else if (g_gameObjects[i].type == OBJ_ENEMY) g_colorBuffer[y][stripe] = 6; // Red
-                        }
-                    }
-                }
-            }
-        }
+    int numColumnBands = (t->width + SCENE_COLUMN_BAND - 1) / SCENE_COLUMN_BAND;
+    int numRowBands = (t->height + SPRITE_BAND_ROWS - 1) / SPRITE_BAND_ROWS;
+    Job** bands = arenaAlloc(arena, sizeof(Job*) * (numColumnBands > numRowBands ? numColumnBands : numRowBands));
+    if (missing || !bands) {
+        graph->failed = 1;
+        return NULL;
     }
+    for (int band = 0; band < numColumnBands; ++band) {
+        bands[band] = addJob(graph, castWallsTask, scene, band);
+    }
+    Job* prepare = addJob(graph, prepareSpritesTask, scene, 0);
+    for (int band = 0; band < numColumnBands; ++band) {
+        jobAfter(prepare, bands[band]);
+    }
+    for (int band = 0; band < numRowBands; ++band) {
+        bands[band] = addJob(graph, spriteBandTask, scene, band);
+        jobAfter(bands[band], prepare);
+    }
+    // Outlines, when on, go over the sprites and under the particles
+    Job* particles = addJob(graph, particlesTask, scene, 0);
+    Job* spritesDone = particles;
+    if (g_outlineEdges) {
+        spritesDone = addJob(graph, outlineTask, scene, 0);
+        jobAfter(particles, spritesDone);
+    }
+    for (int band = 0; band < numRowBands; ++band) {
+        jobAfter(spritesDone, bands[band]);
+    }
+    return particles;
+}
 
-    // --- Build complete display buffer with proper color handling ---
-    int displayRow = 0;
-    
-    // Main screen with colors
-    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+// Renders a frame, on `jobs` if given. Returns -1, leaving `t` untouched, if `arena` runs out
+int renderScene(GameSession* game, FrameTarget* t, FrameArena* arena, JobSystem* jobs) {
+    JobGraph graph;
+    initJobGraph(&graph, arena);
+    addSceneJobs(&graph, game, t, arena);
+    return runJobGraph(jobs, &graph);
+}
+
+// Upper bound on the arena bytes renderScene() takes for a frame
+size_t frameScratchBytes(int width, int height, int numObjects) {
+    size_t slack = FRAME_ARENA_ALIGN;
+    size_t bytes = 3 * (sizeof(float) * width * height + slack);            // Per-pixel depth, outline scratch
+    bytes += sizeof(float) * width + slack;
+    bytes += (numObjects + 1) * sizeof(SpriteInstance) + slack;             // Sprite list
+    bytes += DEPTH_BOUND_LEVELS * 2 * (sizeof(float) * (width / 8 + 2) + slack); // Depth bounds
+    int numJobs = width / SCENE_COLUMN_BAND + 2 * (height / SPRITE_BAND_ROWS) + 7;  // Scene task graph
+    bytes += numJobs * (sizeof(Job) + sizeof(JobLink) + sizeof(Job*) + 2 * slack) + sizeof(SceneJobs) + slack;
+    return bytes;
+}
+
+// --- Function to render the game world to the terminal ---
+// Display lines for screen rows [band * SPRITE_BAND_ROWS, ...) with proper color handling
+void composeSceneRows(void* ctx, int band) {
+    (void)ctx; // Composes the global screen buffers
+    int firstRow = band * SPRITE_BAND_ROWS;
+    int lastRow = firstRow + SPRITE_BAND_ROWS < SCREEN_HEIGHT ? firstRow + SPRITE_BAND_ROWS : SCREEN_HEIGHT;
+    for (int y = firstRow; y < lastRow; ++y) {
         int bufferPos = 0;
         const char* lastColorCode = ""; // Track the last applied color code
         
@@ -497,21 +3620,27 @@ void render() {
             
             // Only apply color code if it's different from the last one
             if (strcmp(currentColorCode, lastColorCode) != 0) {
-                bufferPos += snprintf(g_displayBuffer[displayRow] + bufferPos, 
+                bufferPos += snprintf(g_displayBuffer[y] + bufferPos, 
                                       TOTAL_LINE_BUFFER_SIZE - bufferPos, "%s", currentColorCode);
                 lastColorCode = currentColorCode;
             }
             
             // Add the character
-            bufferPos += snprintf(g_displayBuffer[displayRow] + bufferPos, 
+            bufferPos += snprintf(g_displayBuffer[y] + bufferPos, 
                                   TOTAL_LINE_BUFFER_SIZE - bufferPos, "%c", pixel);
         }
         // Ensure reset at the end of the line
-        bufferPos += snprintf(g_displayBuffer[displayRow] + bufferPos, 
+        bufferPos += snprintf(g_displayBuffer[y] + bufferPos, 
                               TOTAL_LINE_BUFFER_SIZE - bufferPos, "%s", ANSI_COLOR_RESET);
-        g_displayBuffer[displayRow][bufferPos] = '\0'; // Null-terminate the string
-        displayRow++;
+        g_displayBuffer[y][bufferPos] = '\0'; // Null-terminate the string
     }
+}
+
+// HUD, mini-map and help lines below the screen; reads only game state
+void composeHud(void* ctx, int unused) {
+    (void)unused;
+    const GameSession* game = ctx;
+    int displayRow = SCREEN_HEIGHT;
 
     // HUD
     snprintf(g_displayBuffer[displayRow], TOTAL_LINE_BUFFER_SIZE, 
@@ -519,9 +3648,9 @@ void render() {
     displayRow++;
     snprintf(g_displayBuffer[displayRow], TOTAL_LINE_BUFFER_SIZE, 
             "%sHEALTH: %d  %s|  %sAMMO: %d  %s|  %sSCORE: %d%s",
-            ANSI_COLOR_GREEN, g_player.health, ANSI_COLOR_RESET, 
-            ANSI_COLOR_YELLOW, g_player.ammo, ANSI_COLOR_RESET, 
-            ANSI_COLOR_CYAN, g_player.score, ANSI_COLOR_RESET);
+            ANSI_COLOR_GREEN, game->player.health, ANSI_COLOR_RESET, 
+            ANSI_COLOR_YELLOW, game->player.ammo, ANSI_COLOR_RESET, 
+            ANSI_COLOR_CYAN, game->player.score, ANSI_COLOR_RESET);
     displayRow++;
     snprintf(g_displayBuffer[displayRow], TOTAL_LINE_BUFFER_SIZE, 
             "----------------------------------------------------------------------------------------------------");
@@ -533,13 +3662,19 @@ void render() {
     snprintf(g_displayBuffer[displayRow], TOTAL_LINE_BUFFER_SIZE, "--- Mini Map ---");
     displayRow++;
     
-    for (int y = 0; y < MAP_HEIGHT; ++y) {
+    // A MAP_WIDTH x MAP_HEIGHT window that follows the player on larger levels
+    int windowX = (int)game->player.x - MAP_WIDTH / 2, windowY = (int)game->player.y - MAP_HEIGHT / 2;
+    if (windowX > g_mapWidth - MAP_WIDTH) windowX = g_mapWidth - MAP_WIDTH;
+    if (windowY > g_mapHeight - MAP_HEIGHT) windowY = g_mapHeight - MAP_HEIGHT;
+    if (windowX < 0) windowX = 0;
+    if (windowY < 0) windowY = 0;
+    for (int y = windowY; y < windowY + MAP_HEIGHT && y < g_mapHeight; ++y) {
         int bufferPos = 0;
-        for (int x = 0; x < MAP_WIDTH; ++x) {
+        for (int x = windowX; x < windowX + MAP_WIDTH && x < g_mapWidth; ++x) {
             int isDoor = 0;
-            for(int i = 0; i < g_numDoors; ++i) {
-                if (g_doors[i].mapX == x && g_doors[i].mapY == y) {
-                    if (g_doors[i].isOpen) {
+            for(int i = 0; i < game->numDoors; ++i) {
+                if (game->doors[i].mapX == x && game->doors[i].mapY == y) {
+                    if (game->doors[i].open >= 1.0f) {
                         bufferPos += snprintf(g_displayBuffer[displayRow] + bufferPos, 
                                             TOTAL_LINE_BUFFER_SIZE - bufferPos, "%sO%s", ANSI_COLOR_GREEN, ANSI_COLOR_RESET);
                     } else {
@@ -552,11 +3687,15 @@ void render() {
             }
             if (isDoor) continue; // If it was a door, skip map char check
 
-            if ((int)g_player.x == x && (int)g_player.y == y) {
+            if ((int)game->player.x == x && (int)game->player.y == y) {
                 bufferPos += snprintf(g_displayBuffer[displayRow] + bufferPos, 
                                     TOTAL_LINE_BUFFER_SIZE - bufferPos, "%sP%s", ANSI_COLOR_RED, ANSI_COLOR_RESET);
             } else {
                 char mapChar = g_map[y][x];
+                int trigger = game->triggerHead[y][x] - 1;
+                if (trigger >= 0 && g_levelTriggers[trigger].kind != TRIGGER_SPAWN) {
+                    mapChar = g_levelTriggers[trigger].kind == TRIGGER_PLATE ? '_' : '/'; // Spawn zones stay hidden
+                }
                 if (mapChar == '#') {
                     bufferPos += snprintf(g_displayBuffer[displayRow] + bufferPos, 
                                         TOTAL_LINE_BUFFER_SIZE - bufferPos, "%c", mapChar);
@@ -576,10 +3715,10 @@ void render() {
     // Player info and controls
     snprintf(g_displayBuffer[displayRow], TOTAL_LINE_BUFFER_SIZE, 
             "Player X: %.1f, Y: %.1f, Angle: %.2f (deg: %.1f)",
-            g_player.x, g_player.y, g_player.angle, g_player.angle * 180.0f / M_PI);
+            game->player.x, game->player.y, game->player.angle, game->player.angle * 180.0f / M_PI);
     displayRow++;
     snprintf(g_displayBuffer[displayRow], TOTAL_LINE_BUFFER_SIZE, 
-            "Controls: WASD (Move), QE (Rotate), F (Interact), SPACE (Shoot), X (Exit)");
+            "Controls: WASD/Arrows Move, QE Rotate, RV Look, J Jump, C Crouch, F Use, SPACE Shoot, X Exit");
     displayRow++;
 
     // Fill remaining buffer lines
@@ -588,108 +3727,135 @@ void render() {
         displayRow++;
     }
 
+}
+
+// The frame's graph: scene jobs, then the display rows built from them, with the HUD composed
+// alongside since it does not need the scene. Output stays on the calling thread.
+void render(GameSession* game, JobSystem* jobs) {
+    arenaReset(&game->arena);
+    FrameTarget screen = {
+        .width = SCREEN_WIDTH, .height = SCREEN_HEIGHT,
+        .chars = &g_screenBuffer[0][0], .colors = &g_colorBuffer[0][0], .zBuffer = g_zBuffer,
+    };
+    JobGraph graph;
+    initJobGraph(&graph, &game->arena);
+    Job* scene = addSceneJobs(&graph, game, &screen, &game->arena);
+    for (int band = 0; band * SPRITE_BAND_ROWS < SCREEN_HEIGHT; ++band) {
+        jobAfter(addJob(&graph, composeSceneRows, NULL, band), scene);
+    }
+    addJob(&graph, composeHud, game, 0);
+    if (runJobGraph(jobs, &graph) != 0) return; // Out of memory: the last frame stays up
+
     updateDisplay();
 }
 
 // --- Collision detection ---
-int checkCollision(float newX, float newY) {
+int checkCollision(const GameSession* game, float newX, float newY) {
     int mapX = (int)newX;
     int mapY = (int)newY;
 
-    if (mapX < 0 || mapX >= MAP_WIDTH || mapY < 0 || mapY >= MAP_HEIGHT) {
+    if (mapX < 0 || mapX >= g_mapWidth || mapY < 0 || mapY >= g_mapHeight) {
         return 1; // Collision if out of bounds
     }
 
     char cell = g_map[mapY][mapX];
-    if (cell == '#') {
+    if (isSolidCell(cell)) {
         return 1; // Wall collision
     }
     if (cell == 'D') {
-        for (int i = 0; i < g_numDoors; ++i) {
-            if (g_doors[i].mapX == mapX && g_doors[i].mapY == mapY && !g_doors[i].isOpen) {
-                return 1; // Closed door collision
-            }
+        const Door* door = findDoor(game, mapX, mapY);
+        if (door && doorBlocksPoint(door, door->open, newX, newY)) {
+            return 1; // Blocked by the (partly) closed door
         }
     }
     return 0; // No collision
 }
 
 // --- Handle Interactions ---
-void handleInteraction() {
-    for (int i = 0; i < g_numDoors; ++i) {
-        float doorX = g_doors[i].mapX + 0.5f;
-        float doorY = g_doors[i].mapY + 0.5f;
-        float dist = sqrt(pow(g_player.x - doorX, 2) + pow(g_player.y - doorY, 2));
+void handleInteraction(GameSession* game) {
+    // Map switches take priority: the cell ahead of the player, then the one they stand on
+    int aheadX = (int)(game->player.x + sin(game->player.angle) * 0.8f);
+    int aheadY = (int)(game->player.y + cos(game->player.angle) * 0.8f);
+    if (fireTriggers(game, aheadX, aheadY, TRIGGER_USE) > 0) return;
+    if (fireTriggers(game, (int)game->player.x, (int)game->player.y, TRIGGER_USE) > 0) return;
+
+    for (int i = 0; i < game->numDoors; ++i) {
+        float doorX = game->doors[i].mapX + 0.5f;
+        float doorY = game->doors[i].mapY + 0.5f;
+        float dist = sqrt(pow(game->player.x - doorX, 2) + pow(game->player.y - doorY, 2));
 
         if (dist < 1.5f) { // Close enough to interact with door
-            g_doors[i].isOpen = !g_doors[i].isOpen; // Toggle door state
+            setDoorTarget(game, i, !game->doors[i].isOpen); // Start sliding the other way
             return;
         }
     }
 
-    for (int i = 0; i < g_numGameObjects; ++i) {
-        if (!g_gameObjects[i].active) continue; // Skip inactive objects
+    for (int i = 0; i < game->numObjects; ++i) {
+        if (!game->objects[i].active) continue; // Skip inactive objects
 
-        float objX = g_gameObjects[i].x;
-        float objY = g_gameObjects[i].y;
-        float dist = sqrt(pow(g_player.x - objX, 2) + pow(g_player.y - objY, 2));
+        float objX = game->objects[i].x;
+        float objY = game->objects[i].y;
+        float dist = sqrt(pow(game->player.x - objX, 2) + pow(game->player.y - objY, 2));
 
         if (dist < 0.8f) { // Close enough to pick up/interact with object
-            switch (g_gameObjects[i].type) {
+            switch (game->objects[i].type) {
                 case OBJ_HEALTH:
-                    g_player.health += 25;
-                    if (g_player.health > 100) g_player.health = 100; // Cap health
+                    game->player.health += 25;
+                    if (game->player.health > 100) game->player.health = 100; // Cap health
                     break;
                 case OBJ_AMMO:
-                    g_player.ammo += 10;
+                    game->player.ammo += 10;
                     break;
                 case OBJ_ENEMY:
                     // Player cannot "pick up" enemies in this context,
                     // but interaction key could trigger melee attack if implemented
                     break;
             }
-            g_gameObjects[i].active = 0; // Deactivate object after interaction
+            game->objects[i].active = 0; // Deactivate object after interaction
             return;
         }
     }
 }
 
 // --- Handle Shooting ---
-void handleShooting() {
-    if (g_player.ammo <= 0) {
+void handleShooting(GameSession* game) {
+    if (game->player.ammo <= 0) {
         return; // No ammo
     }
 
-    g_player.ammo--; // Consume ammo
+    game->player.ammo--; // Consume ammo
+    emitSound(game, (int)game->player.x, (int)game->player.y, SOUND_SHOT_LOUDNESS);
 
     float rayLength = 0.0f;
     float stepSize = 0.1f; // Smaller steps for more precise hit detection
     float maxShootDistance = 10.0f;
 
-    float eyeX = sin(g_player.angle); // Player's forward X direction
-    float eyeY = cos(g_player.angle); // Player's forward Y direction
+    float eyeX = sin(game->player.angle); // Player's forward X direction
+    float eyeY = cos(game->player.angle); // Player's forward Y direction
 
     while (rayLength < maxShootDistance) {
-        float testX = g_player.x + eyeX * rayLength;
-        float testY = g_player.y + eyeY * rayLength;
+        float testX = game->player.x + eyeX * rayLength;
+        float testY = game->player.y + eyeY * rayLength;
 
         // Check for collision with walls/doors first (optional, but realistic for bullets)
         int mapTestX = (int)testX;
         int mapTestY = (int)testY;
-        if (mapTestX >= 0 && mapTestX < MAP_WIDTH && mapTestY >= 0 && mapTestY < MAP_HEIGHT) {
+        // Impact point just in front of the surface, for effects
+        float impactX = testX - eyeX * stepSize;
+        float impactY = testY - eyeY * stepSize;
+        if (mapTestX >= 0 && mapTestX < g_mapWidth && mapTestY >= 0 && mapTestY < g_mapHeight) {
             char cell = g_map[mapTestY][mapTestX];
             if (cell == '#') {
+                spawnParticleBurst(&game->particles, PARTICLE_SPARK, impactX, impactY, 0.5f, 24);
+                spawnParticleBurst(&game->particles, PARTICLE_SMOKE, impactX, impactY, 0.5f, 6);
                 return; // Bullet hit a wall
             }
+            if (cell == PORTAL_CELL) return; // Lost through the portal
             if (cell == 'D') {
-                 int isDoorClosed = 0;
-                for (int i = 0; i < g_numDoors; ++i) {
-                    if (g_doors[i].mapX == mapTestX && g_doors[i].mapY == mapTestY && !g_doors[i].isOpen) {
-                        isDoorClosed = 1;
-                        break;
-                    }
-                }
-                if (isDoorClosed) {
+                const Door* door = findDoor(game, mapTestX, mapTestY);
+                if (door && doorBlocksPoint(door, door->open, testX, testY)) {
+                    spawnParticleBurst(&game->particles, PARTICLE_SPARK, impactX, impactY, 0.5f, 24);
+                    spawnParticleBurst(&game->particles, PARTICLE_SMOKE, impactX, impactY, 0.5f, 6);
                     return; // Bullet hit a closed door
                 }
             }
@@ -697,14 +3863,15 @@ void handleShooting() {
 
 
         // Check for collision with enemies
-        for (int i = 0; i < g_numGameObjects; ++i) {
-            if (g_gameObjects[i].active && g_gameObjects[i].type == OBJ_ENEMY) {
-                float distToEnemy = sqrt(pow(testX - g_gameObjects[i].x, 2) + pow(testY - g_gameObjects[i].y, 2));
+        for (int i = 0; i < game->numObjects; ++i) {
+            if (game->objects[i].active && game->objects[i].type == OBJ_ENEMY) {
+                float distToEnemy = sqrt(pow(testX - game->objects[i].x, 2) + pow(testY - game->objects[i].y, 2));
                 if (distToEnemy < 0.5f) { // If ray is close enough to enemy center
-                    g_gameObjects[i].health -= 25; // Apply damage
-                    if (g_gameObjects[i].health <= 0) {
-                        g_gameObjects[i].active = 0; // Enemy defeated
-                        g_player.score += 100; // Award score
+                    spawnParticleBurst(&game->particles, PARTICLE_BLOOD, testX, testY, 0.5f, 32);
+                    game->objects[i].health -= 25; // Apply damage
+                    if (game->objects[i].health <= 0) {
+                        game->objects[i].active = 0; // Enemy defeated
+                        game->player.score += 100; // Award score
                     }
                     return; // Bullet hit an enemy, stop ray
                 }
@@ -714,128 +3881,1131 @@ void handleShooting() {
     }
 }
 
-int main() {
+// --- Player Movement ---
+// Kinematic player state laid out structure-of-arrays, so a batch of sessions steers in one
+// branch-free pass. A single player is the same view with count 1 over its own fields.
+typedef struct {
+    float *x, *y, *angle;
+    float *velX, *velY, *turnVel;
+} PlayerKinematics;
+
+// Accelerates players [first, last) toward the velocity their held actions ask for, turns them,
+// and writes the unobstructed positions they would reach this tick to moveX/moveY
+void steerPlayers(const PlayerKinematics* k, const unsigned int* held, int first, int last,
+                  float dt, float* moveX, float* moveY) {
+    for (int i = first; i < last; ++i) {
+        unsigned int h = held[i];
+        float forward = (float)((h & ACTION_FORWARD) != 0) - (float)((h & ACTION_BACK) != 0);
+        float strafe = (float)((h & ACTION_STRAFE_RIGHT) != 0) - (float)((h & ACTION_STRAFE_LEFT) != 0);
+        float turn = (float)((h & ACTION_TURN_RIGHT) != 0) - (float)((h & ACTION_TURN_LEFT) != 0);
+
+        // Wished velocity in world space; diagonal movement is normalized to the same top speed
+        float fwdX = sinf(k->angle[i]), fwdY = cosf(k->angle[i]);
+        float wishX = fwdX * forward - fwdY * strafe;
+        float wishY = fwdY * forward + fwdX * strafe;
+        float wishLen = sqrtf(wishX * wishX + wishY * wishY);
+        float scale = wishLen > 0.0f ? PLAYER_MOVE_SPEED / wishLen : 0.0f;
+
+        float rate = (wishLen > 0.0f ? PLAYER_ACCEL : PLAYER_FRICTION) * dt;
+        k->velX[i] = approach(k->velX[i], wishX * scale, rate);
+        k->velY[i] = approach(k->velY[i], wishY * scale, rate);
+        k->turnVel[i] = approach(k->turnVel[i], turn * PLAYER_ROT_SPEED, PLAYER_TURN_ACCEL * dt);
+        k->angle[i] += k->turnVel[i] * dt;
+        moveX[i] = k->x[i] + k->velX[i] * dt;
+        moveY[i] = k->y[i] + k->velY[i] * dt;
+    }
+}
+
+// Moves the player to (newPlayerX, newPlayerY), sliding along walls it would hit
+void resolvePlayerMove(GameSession* game, float newPlayerX, float newPlayerY) {
+    if (game->player.velX == 0.0f && game->player.velY == 0.0f) return;
+    float oldX = game->player.x, oldY = game->player.y;
+
+    // Apply movement if no collision occurs
+    if (!checkCollision(game, newPlayerX, newPlayerY)) {
+        game->player.x = newPlayerX;
+        game->player.y = newPlayerY;
+    }
+    // Basic slide collision resolution (try moving along one axis if direct move fails)
+    else if (!checkCollision(game, newPlayerX, game->player.y)) {
+        game->player.x = newPlayerX;
+        game->player.velY = 0.0f;
+    } else if (!checkCollision(game, game->player.x, newPlayerY)) {
+        game->player.y = newPlayerY;
+        game->player.velX = 0.0f;
+    } else {
+        game->player.velX = 0.0f;
+        game->player.velY = 0.0f;
+    }
+    crossCells(game, oldX, oldY);
+
+    const PortalDef* portal = findPortal((int)game->player.x, (int)game->player.y);
+    if (portal && ((int)oldX != portal->mapX || (int)oldY != portal->mapY)) {
+        double x = game->player.x, y = game->player.y;
+        passThroughPortal(portal, &x, &y);
+        if (checkCollision(game, (float)x, (float)y)) {
+            // Nowhere to come out: the portal is a wall
+            float enteredX = game->player.x, enteredY = game->player.y;
+            game->player.x = oldX;
+            game->player.y = oldY;
+            game->player.velX = game->player.velY = 0.0f;
+            crossCells(game, enteredX, enteredY);
+            return;
+        }
+        double velX = game->player.velX, velY = game->player.velY;
+        turnThroughPortal(portal, &velX, &velY);
+        float portalX = game->player.x, portalY = game->player.y;
+        game->player.x = (float)x;
+        game->player.y = (float)y;
+        game->player.velX = (float)velX;
+        game->player.velY = (float)velY;
+        game->player.angle -= (portal->turns & 3) * (float)M_PI / 2.0f; // Matches turnThroughPortal()
+        crossCells(game, portalX, portalY);
+    }
+}
+
+// Moves the horizon one step per look action, up to PLAYER_MAX_PITCH either way
+void lookVertically(GameSession* game, unsigned int action) {
+    float pitch = game->player.pitch;
+    if (action & ACTION_LOOK_UP) pitch += PLAYER_PITCH_STEP;
+    if (action & ACTION_LOOK_DOWN) pitch -= PLAYER_PITCH_STEP;
+    if (pitch > PLAYER_MAX_PITCH) pitch = PLAYER_MAX_PITCH;
+    if (pitch < -PLAYER_MAX_PITCH) pitch = -PLAYER_MAX_PITCH;
+    game->player.pitch = pitch;
+}
+
+// Starts a jump from the floor, or toggles crouching
+void changeStance(GameSession* game, unsigned int action) {
+    Player* p = &game->player;
+    if ((action & ACTION_JUMP) && p->jumpZ <= 0.0f) p->velZ = PLAYER_JUMP_SPEED;
+    if (action & ACTION_CROUCH) p->crouched = !p->crouched;
+}
+
+// Eases the eye toward the stance's height and carries a jump through its arc
+void updateEyeHeight(Player* p, float dt) {
+    float stance = p->crouched ? PLAYER_CROUCH_HEIGHT : PLAYER_EYE_HEIGHT;
+    p->eyeHeight = approach(p->eyeHeight, stance, PLAYER_STANCE_SPEED * dt);
+    if (p->jumpZ > 0.0f || p->velZ > 0.0f) {
+        p->velZ -= PLAYER_GRAVITY * dt;
+        p->jumpZ += p->velZ * dt;
+        if (p->jumpZ <= 0.0f) p->jumpZ = p->velZ = 0.0f; // Landed
+    }
+}
+
+// Integrates one fixed step of player motion from the held movement bits (ACTION_FORWARD...)
+void updatePlayerMovement(GameSession* game, float dt, unsigned int held) {
+    Player* p = &game->player;
+    PlayerKinematics self = { &p->x, &p->y, &p->angle, &p->velX, &p->velY, &p->turnVel };
+    float newPlayerX, newPlayerY;
+    steerPlayers(&self, &held, 0, 1, dt, &newPlayerX, &newPlayerY);
+    resolvePlayerMove(game, newPlayerX, newPlayerY);
+}
+
+// --- Enemy AI ---
+#define AI_SIGHT_RANGE 10.0f
+#define AI_NEAR_RANGE 4.0f
+#define AI_MID_RANGE 10.0f
+#define AI_ATTACK_RANGE 0.9f
+#define AI_MOVE_SPEED 1.4f       // Map units per second
+#define AI_ATTACK_DAMAGE 10
+#define AI_ATTACK_SECONDS 1.0f
+#define AI_DORMANT_TICKS 32      // Idle enemies out of sight look around this rarely
+
+// Walks the grid from (x0, y0) to (x1, y1); walls, portals and panels of doors not fully open
+// block (sight does not follow portals)
+int hasLineOfSight(const GameSession* game, float x0, float y0, float x1, float y1) {
+    float dx = x1 - x0, dy = y1 - y0;
+    int steps = (int)(sqrtf(dx * dx + dy * dy) * 4.0f) + 1;
+    for (int i = 1; i < steps; ++i) {
+        float t = (float)i / steps;
+        int cellX = (int)(x0 + dx * t), cellY = (int)(y0 + dy * t);
+        char cell = g_map[cellY][cellX];
+        if (cell == '#' || cell == PORTAL_CELL) return 0;
+        if (cell == 'D') {
+            const Door* door = findDoor(game, cellX, cellY);
+            if (door && door->open < 1.0f) return 0;
+        }
+    }
+    return 1;
+}
+
+// One think: notice the player, close in and attack. `elapsed` covers the ticks since the
+// last think, so rarely-thinking enemies still move at their real speed. Returns the ticks
+// until the next think.
+unsigned int thinkEnemy(GameSession* game, GameObject* enemy, float elapsed) {
+    float dx = game->player.x - enemy->x, dy = game->player.y - enemy->y;
+    float dist = sqrtf(dx * dx + dy * dy);
+    int inSight = dist < AI_SIGHT_RANGE && hasLineOfSight(game, enemy->x, enemy->y, game->player.x, game->player.y);
+    if (inSight) enemy->aiState = AI_CHASE;
+    // Gunfire that reached this cell since the last think
+    unsigned int heard = game->alertStamp[(int)enemy->y][(int)enemy->x];
+    if (heard > enemy->heardSound) {
+        enemy->heardSound = heard;
+        enemy->aiState = AI_CHASE;
+    }
+
+    enemy->attackCooldown -= elapsed;
+    if (enemy->aiState == AI_CHASE) {
+        enemy->heading = atan2f(dx, dy);
+        if (dist > AI_ATTACK_RANGE) {
+            // Stop a little inside attack range
+            float step = AI_MOVE_SPEED * elapsed;
+            if (step > dist - AI_ATTACK_RANGE * 0.8f) step = dist - AI_ATTACK_RANGE * 0.8f;
+            float newX = enemy->x + dx / dist * step, newY = enemy->y + dy / dist * step;
+            if (!checkCollision(game, newX, newY)) {
+                enemy->x = newX;
+                enemy->y = newY;
+            } else if (!checkCollision(game, newX, enemy->y)) {
+                enemy->x = newX;
+            } else if (!checkCollision(game, enemy->x, newY)) {
+                enemy->y = newY;
+            }
+            dist -= step;
+        }
+        if (dist <= AI_ATTACK_RANGE && enemy->attackCooldown <= 0.0f) {
+            game->player.health -= AI_ATTACK_DAMAGE;
+            enemy->attackCooldown = AI_ATTACK_SECONDS;
+        }
+    }
+
+    if (inSight || dist < AI_NEAR_RANGE) return 1;
+    if (enemy->aiState == AI_IDLE) return AI_DORMANT_TICKS;
+    return dist < AI_MID_RANGE ? 4 : 16;
+}
+
+// Runs this tick's slot of the wheel, up to the think budget
+void updateEnemies(GameSession* game) {
+    game->tick++;
+    int slot = game->tick % AI_WHEEL_SLOTS;
+    int index = game->aiWheel[slot], last = game->aiWheelTail[slot];
+    game->aiWheel[slot] = game->aiWheelTail[slot] = -1;
+    for (int thinks = 0; index >= 0; ++thinks) {
+        GameObject* enemy = &game->objects[index];
+        int next = enemy->wheelNext;
+        if (thinks >= AI_THINK_BUDGET) {
+            // Over budget: the rest go first next tick, still in order (thinks never book the
+            // current slot, so `last` still ends this chain)
+            int nextSlot = (slot + 1) % AI_WHEEL_SLOTS;
+            game->objects[last].wheelNext = game->aiWheel[nextSlot];
+            if (game->aiWheel[nextSlot] < 0) game->aiWheelTail[nextSlot] = last;
+            game->aiWheel[nextSlot] = index;
+            break;
+        } else if (enemy->active) {
+            unsigned int delay = thinkEnemy(game, enemy, (game->tick - enemy->lastThink) * TICK_SECONDS);
+            enemy->lastThink = game->tick;
+            scheduleThink(game, index, delay);
+        }
+        index = next; // Dead enemies simply drop out of the wheel
+    }
+}
+
+// --- Shared Frame Export ---
+// Publishes a session's frames into shared memory for outside readers (see minidoom.h). The
+// seqlock keeps the game from ever waiting: readers retry if the counter moved under them.
+typedef struct SharedFrameExport {
+    MinidoomSharedFrame* header;
+    size_t bytes;
+    char name[64];
+} SharedFrameExport;
+
+// Returns 0 on success
+int openSharedFrame(SharedFrameExport* out, const char* name, int width, int height) {
+#ifdef _WIN32
+    fprintf(stderr, "Shared frame export is not supported on Windows\n");
+    return -1;
+#else
+    if (width < 1 || height < 1) return -1;
+    snprintf(out->name, sizeof(out->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    size_t cells = (size_t)width * height;
+    size_t depthOffset = (sizeof(MinidoomSharedFrame) + 2 * cells + 3) & ~(size_t)3;
+    out->bytes = depthOffset + sizeof(float) * width;
+
+    int fd = shm_open(out->name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    void* region = MAP_FAILED;
+    if (ftruncate(fd, out->bytes) == 0) {
+        region = mmap(NULL, out->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (region == MAP_FAILED) {
+        perror("shared frame");
+        shm_unlink(out->name);
+        return -1;
+    }
+
+    memset(region, 0, out->bytes);
+    out->header = region;
+    out->header->magic = MINIDOOM_SHARED_MAGIC;
+    out->header->version = MINIDOOM_SHARED_VERSION;
+    out->header->width = width;
+    out->header->height = height;
+    out->header->cellsOffset = sizeof(MinidoomSharedFrame);
+    out->header->colorsOffset = sizeof(MinidoomSharedFrame) + cells;
+    out->header->depthOffset = depthOffset;
+    return 0;
+#endif
+}
+
+void closeSharedFrame(SharedFrameExport* out) {
+#ifndef _WIN32
+    if (!out->header) return;
+    munmap(out->header, out->bytes);
+    shm_unlink(out->name);
+    out->header = NULL;
+#endif
+}
+
+// Copies a finished frame in; NULL buffers leave the previous contents
+void publishSharedFrame(SharedFrameExport* out, const Player* player,
+                        const char* cells, const char* colors, const float* depth) {
+    MinidoomSharedFrame* h = out->header;
+    if (!h) return;
+    unsigned char* base = (unsigned char*)h;
+    size_t count = (size_t)h->width * h->height;
+    uint32_t sequence = h->sequence;
+
+    __atomic_store_n(&h->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // Odd count lands before any data changes
+    if (cells) memcpy(base + h->cellsOffset, cells, count);
+    if (colors) memcpy(base + h->colorsOffset, colors, count);
+    if (depth) memcpy(base + h->depthOffset, depth, sizeof(float) * h->width);
+    h->x = player->x;
+    h->y = player->y;
+    h->angle = player->angle;
+    h->health = player->health;
+    h->ammo = player->ammo;
+    h->score = player->score;
+    h->frame++;
+    __atomic_store_n(&h->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+// --- Session Lifecycle ---
+void resetGameSession(GameSession* game) {
+    game->player = g_playerStart;
+    initializeGameElements(game);
+    game->particles.head = 0;
+    game->particles.used = 0;
+    game->particles.longestLife = 0.0f;
+}
+
+// Returns 0 on success
+int initGameSession(GameSession* game, unsigned int particleCapacity) {
+    memset(game, 0, sizeof(*game));
+    if (initParticleSystem(&game->particles, particleCapacity) != 0) return -1;
+    resetGameSession(game);
+    g_liveSessions++;
+    return 0;
+}
+
+void freeGameSession(GameSession* game) {
+    if (game->shared) {
+        closeSharedFrame(game->shared);
+        free(game->shared);
+        game->shared = NULL;
+    }
+    freeParticleSystem(&game->particles);
+    freeViewRows(&game->viewRows);
+    arenaRelease(&game->arena);
+    g_liveSessions--;
+}
+
+// Everything that moves on its own after the player has: doors, enemies, effects
+void advanceWorld(GameSession* game, float dt) {
+    updateDoors(game, dt);
+    updateEnemies(game);
+    updateParticles(&game->particles, dt);
+}
+
+// Advances one fixed tick: one-shot actions, then movement and effects
+void tickGameSession(GameSession* game, unsigned int input, float dt) {
+    if (input & ACTION_INTERACT) handleInteraction(game);
+    if (input & ACTION_SHOOT) handleShooting(game);
+    if (input & (ACTION_LOOK_UP | ACTION_LOOK_DOWN)) lookVertically(game, input);
+    if (input & (ACTION_JUMP | ACTION_CROUCH)) changeStance(game, input);
+    updatePlayerMovement(game, dt, input);
+    updateEyeHeight(&game->player, dt);
+    advanceWorld(game, dt);
+}
+
+// Atlas shared by every session; built on first use. Returns 0 on success
+int initRenderer() {
+    static int status = 1; // Not built yet
+    if (status > 0) status = buildSpriteAtlas();
+    return status;
+}
+
+// --- Environment API (minidoom.h) ---
+GameSession* envCreate(int width, int height) {
+    if (width < 1 || height < 1 || initRenderer() != 0) return NULL;
+    GameSession* env = malloc(sizeof(GameSession));
+    if (!env) return NULL;
+    if (initGameSession(env, ENV_PARTICLE_CAPACITY) != 0) {
+        free(env);
+        return NULL;
+    }
+    env->obsWidth = width;
+    env->obsHeight = height;
+    // Size the arena for a whole frame now, so stepping never allocates
+    if (arenaReserve(&env->arena, frameScratchBytes(width, height, MAX_GAME_OBJECTS)) != 0 ||
+        prepareViewRows(&env->viewRows, height, 0, PLAYER_EYE_HEIGHT) != 0) {
+        freeGameSession(env);
+        free(env);
+        return NULL;
+    }
+    return env;
+}
+
+int envPublish(GameSession* env, const char* name) {
+    SharedFrameExport* shared = calloc(1, sizeof(SharedFrameExport));
+    if (!shared || openSharedFrame(shared, name, env->obsWidth, env->obsHeight) != 0) {
+        free(shared);
+        return -1;
+    }
+    if (env->shared) {
+        closeSharedFrame(env->shared);
+        free(env->shared);
+    }
+    env->shared = shared;
+    return 0;
+}
+
+void envDestroy(GameSession* env) {
+    if (!env) return;
+    freeGameSession(env);
+    free(env);
+}
+
+int writeObservation(GameSession* env, EnvObservation* obs, float reward) {
+    // Render straight into the caller's buffers
+    int status = 0;
+    if (obs->cells && obs->colors && obs->depth) {
+        arenaReset(&env->arena);
+        FrameTarget view = {
+            .width = env->obsWidth, .height = env->obsHeight,
+            .chars = obs->cells, .colors = obs->colors, .zBuffer = obs->depth,
+        };
+        status = renderScene(env, &view, &env->arena, NULL); // Batches already spread sessions over cores
+    }
+    obs->x = env->player.x;
+    obs->y = env->player.y;
+    obs->angle = env->player.angle;
+    obs->health = env->player.health;
+    obs->ammo = env->player.ammo;
+    obs->score = env->player.score;
+    obs->reward = reward;
+    obs->done = env->player.health <= 0;
+    if (env->shared) {
+        publishSharedFrame(env->shared, &env->player, obs->cells, obs->colors, obs->depth);
+    }
+    return status;
+}
+
+int envReset(GameSession* env, EnvObservation* obs) {
+    resetGameSession(env);
+    return writeObservation(env, obs, 0.0f);
+}
+
+int envStep(GameSession* env, unsigned int action, EnvObservation* obs) {
+    int scoreBefore = env->player.score;
+    tickGameSession(env, action, TICK_SECONDS);
+    return writeObservation(env, obs, (float)(env->player.score - scoreBefore));
+}
+
+// --- Batch Environments (minidoom.h) ---
+// Independent sessions advanced in lockstep. Player kinematics live structure-of-arrays across
+// the batch and are steered a shard at a time; collision, shooting and rendering then run per
+// session, since each ray walks its own map cells. Shards are contiguous runs of sessions handed
+// to the job system, so each thread keeps to its own slice of every array.
+#define BATCH_SHARDS_PER_THREAD 4
+
+struct EnvBatch {
+    GameSession** sessions;
+    int count;
+    float* lanes;             // Backing block for the arrays below
+    PlayerKinematics players; // Authoritative kinematics; copied into sessions while they step
+    float *moveX, *moveY;     // Steered positions before collision
+    unsigned int* actions;    // This step's actions
+    EnvObservation* obs;      // This step's observations
+    int numShards;
+    JobSystem jobs;
+};
+
+void loadBatchPlayer(EnvBatch* batch, int i) {
+    const Player* p = &batch->sessions[i]->player;
+    batch->players.x[i] = p->x;
+    batch->players.y[i] = p->y;
+    batch->players.angle[i] = p->angle;
+    batch->players.velX[i] = p->velX;
+    batch->players.velY[i] = p->velY;
+    batch->players.turnVel[i] = p->turnVel;
+}
+
+void stepBatchShard(void* ctx, int shard) {
+    EnvBatch* batch = ctx;
+    int first = (int)((long)batch->count * shard / batch->numShards);
+    int last = (int)((long)batch->count * (shard + 1) / batch->numShards);
+    steerPlayers(&batch->players, batch->actions, first, last, TICK_SECONDS, batch->moveX, batch->moveY);
+
+    for (int i = first; i < last; ++i) {
+        GameSession* game = batch->sessions[i];
+        unsigned int action = batch->actions[i];
+        // Finished sessions restart instead of stepping
+        if (game->player.health <= 0) {
+            envReset(game, &batch->obs[i]);
+            loadBatchPlayer(batch, i);
+            continue;
+        }
+
+        // Same order as tickGameSession(): one-shot actions see the pre-step pose
+        int scoreBefore = game->player.score;
+        if (action & ACTION_INTERACT) handleInteraction(game);
+        if (action & ACTION_SHOOT) handleShooting(game);
+        if (action & (ACTION_LOOK_UP | ACTION_LOOK_DOWN)) lookVertically(game, action);
+        if (action & (ACTION_JUMP | ACTION_CROUCH)) changeStance(game, action);
+        game->player.angle = batch->players.angle[i];
+        game->player.velX = batch->players.velX[i];
+        game->player.velY = batch->players.velY[i];
+        game->player.turnVel = batch->players.turnVel[i];
+        resolvePlayerMove(game, batch->moveX[i], batch->moveY[i]);
+        updateEyeHeight(&game->player, TICK_SECONDS);
+        advanceWorld(game, TICK_SECONDS);
+        loadBatchPlayer(batch, i);
+        writeObservation(game, &batch->obs[i], (float)(game->player.score - scoreBefore));
+    }
+}
+
+void resetBatchShard(void* ctx, int shard) {
+    EnvBatch* batch = ctx;
+    int first = (int)((long)batch->count * shard / batch->numShards);
+    int last = (int)((long)batch->count * (shard + 1) / batch->numShards);
+    for (int i = first; i < last; ++i) {
+        envReset(batch->sessions[i], &batch->obs[i]);
+        loadBatchPlayer(batch, i);
+    }
+}
+
+EnvBatch* envBatchCreate(int count, int width, int height, int threads) {
+    if (count < 1) return NULL;
+    EnvBatch* batch = calloc(1, sizeof(EnvBatch));
+    if (!batch) return NULL;
+    batch->count = count;
+    batch->sessions = calloc(count, sizeof(GameSession*));
+    batch->lanes = malloc(sizeof(float) * count * 8);
+    batch->actions = calloc(count, sizeof(unsigned int));
+    if (!batch->sessions || !batch->lanes || !batch->actions || initJobSystem(&batch->jobs, threads) != 0) {
+        envBatchDestroy(batch);
+        return NULL;
+    }
+    float** lanes[8] = { &batch->players.x, &batch->players.y, &batch->players.angle, &batch->players.velX,
+                         &batch->players.velY, &batch->players.turnVel, &batch->moveX, &batch->moveY };
+    for (int i = 0; i < 8; ++i) {
+        *lanes[i] = batch->lanes + (size_t)count * i;
+    }
+    for (int i = 0; i < count; ++i) {
+        batch->sessions[i] = envCreate(width, height);
+        if (!batch->sessions[i]) {
+            envBatchDestroy(batch);
+            return NULL;
+        }
+        loadBatchPlayer(batch, i);
+    }
+    batch->numShards = batch->jobs.numThreads * BATCH_SHARDS_PER_THREAD;
+    if (batch->numShards > count) batch->numShards = count;
+    return batch;
+}
+
+void envBatchReset(EnvBatch* batch, EnvObservation* obs) {
+    batch->obs = obs;
+    runJobs(&batch->jobs, batch->numShards, resetBatchShard, batch);
+}
+
+void envBatchStep(EnvBatch* batch, const unsigned int* actions, EnvObservation* obs) {
+    memcpy(batch->actions, actions, sizeof(unsigned int) * batch->count);
+    batch->obs = obs;
+    runJobs(&batch->jobs, batch->numShards, stepBatchShard, batch);
+}
+
+void envBatchDestroy(EnvBatch* batch) {
+    if (!batch) return;
+    if (batch->jobs.deques) freeJobSystem(&batch->jobs);
+    if (batch->sessions) {
+        for (int i = 0; i < batch->count; ++i) {
+            envDestroy(batch->sessions[i]);
+        }
+    }
+    free(batch->sessions);
+    free(batch->lanes);
+    free(batch->actions);
+    free(batch);
+}
+
+// --- Image Export ---
+// Cells become pixels: the color index picks the hue and the glyph's ink coverage the brightness,
+// so the distance shading ramp survives in the image. Output is binary PPM or PNG (stored,
+// uncompressed deflate blocks, so no zlib is needed), chosen by the file extension.
+typedef struct {
+    unsigned char r, g, b;
+} Rgb;
+
+const Rgb g_palette[7] = {
+    { 170, 170, 170 }, // 0: Default
+    { 0, 205, 205 },   // 1: Cyan
+    { 60, 80, 230 },   // 2: Blue
+    { 190, 190, 190 }, // 3: Light Gray
+    { 0, 205, 0 },     // 4: Green
+    { 230, 230, 0 },   // 5: Yellow
+    { 220, 40, 40 },   // 6: Red
+};
+
+unsigned int g_crcTable[256];
+
+void initCrcTable() {
+    for (unsigned int n = 0; n < 256; ++n) {
+        unsigned int c = n;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        g_crcTable[n] = c;
+    }
+}
+
+unsigned int crc32Update(unsigned int crc, const unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) crc = g_crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+float glyphCoverage(char c) {
+    switch (c) {
+        case ' ': return 0.0f;
+        case '.': case ',': return 0.3f;
+        case '-': return 0.5f;
+        case '=': return 0.7f;
+        case '#': case '%': case '@': return 1.0f;
+        default: return 0.85f; // Sprite art and other marks
+    }
+}
+
+// Converts a frame's cells to RGB. Each row is preceded by `rowPrefix` zero bytes (the PNG
+// filter byte) so both encoders can share the buffer layout.
+void frameToRgb(const FrameTarget* t, unsigned char* out, int rowPrefix) {
+    for (int y = 0; y < t->height; ++y) {
+        for (int p = 0; p < rowPrefix; ++p) *out++ = 0;
+        for (int x = 0; x < t->width; ++x) {
+            int i = y * t->width + x;
+            int color = t->colors[i] >= 0 && t->colors[i] <= 6 ? t->colors[i] : 0;
+            float k = glyphCoverage(t->chars[i]);
+            *out++ = (unsigned char)(g_palette[color].r * k);
+            *out++ = (unsigned char)(g_palette[color].g * k);
+            *out++ = (unsigned char)(g_palette[color].b * k);
+        }
+    }
+}
+
+void putBigEndian32(unsigned char* p, unsigned int v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+int writePngChunk(FILE* f, const char* type, const unsigned char* data, size_t len) {
+    unsigned char header[8];
+    putBigEndian32(header, (unsigned int)len);
+    memcpy(header + 4, type, 4);
+    unsigned int crc = crc32Update(0xFFFFFFFFu, header + 4, 4);
+    crc = crc32Update(crc, data, len) ^ 0xFFFFFFFFu;
+    unsigned char trailer[4];
+    putBigEndian32(trailer, crc);
+    return fwrite(header, 1, 8, f) == 8 && fwrite(data, 1, len, f) == len && fwrite(trailer, 1, 4, f) == 4;
+}
+
+// Returns 0 on success
+int writeFrameImage(const char* path, const FrameTarget* t) {
+    size_t len = strlen(path);
+    int png = len > 4 && strcmp(path + len - 4, ".png") == 0;
+    size_t rowBytes = (size_t)t->width * 3 + (png ? 1 : 0);
+    size_t rawSize = rowBytes * t->height;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return -1;
+    }
+    int ok;
+    if (!png) {
+        unsigned char* rgb = malloc(rawSize);
+        if (!rgb) {
+            fclose(f);
+            return -1;
+        }
+        frameToRgb(t, rgb, 0);
+        fprintf(f, "P6\n%d %d\n255\n", t->width, t->height);
+        ok = fwrite(rgb, 1, rawSize, f) == rawSize;
+        free(rgb);
+    } else {
+        // zlib stream: 2-byte header, stored blocks of up to 65535 bytes, Adler-32 trailer
+        size_t numBlocks = (rawSize + 65534) / 65535;
+        size_t idatSize = 2 + rawSize + numBlocks * 5 + 4;
+        unsigned char* idat = malloc(idatSize);
+        unsigned char* raw = malloc(rawSize);
+        if (!idat || !raw) {
+            free(idat);
+            free(raw);
+            fclose(f);
+            return -1;
+        }
+        frameToRgb(t, raw, 1);
+
+        unsigned char* out = idat;
+        *out++ = 0x78;
+        *out++ = 0x01;
+        unsigned int adlerA = 1, adlerB = 0;
+        for (size_t pos = 0; pos < rawSize; pos += 65535) {
+            size_t n = rawSize - pos < 65535 ? rawSize - pos : 65535;
+            *out++ = pos + n == rawSize ? 1 : 0; // BFINAL, BTYPE = stored
+            *out++ = n & 0xFF;
+            *out++ = n >> 8;
+            *out++ = ~n & 0xFF;
+            *out++ = (~n >> 8) & 0xFF;
+            memcpy(out, raw + pos, n);
+            out += n;
+            for (size_t i = 0; i < n; ++i) {
+                adlerA = (adlerA + raw[pos + i]) % 65521;
+                adlerB = (adlerB + adlerA) % 65521;
+            }
+        }
+        putBigEndian32(out, (adlerB << 16) | adlerA);
+
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        unsigned char ihdr[13];
+        putBigEndian32(ihdr, t->width);
+        putBigEndian32(ihdr + 4, t->height);
+        ihdr[8] = 8;  // Bit depth
+        ihdr[9] = 2;  // Truecolor RGB
+        ihdr[10] = 0; // Deflate
+        ihdr[11] = 0; // Adaptive filtering (every row uses filter 0)
+        ihdr[12] = 0; // No interlace
+        ok = fwrite(signature, 1, 8, f) == 8 && writePngChunk(f, "IHDR", ihdr, 13) &&
+             writePngChunk(f, "IDAT", idat, idatSize) && writePngChunk(f, "IEND", NULL, 0);
+        free(idat);
+        free(raw);
+    }
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "Failed writing %s\n", path);
+    return ok ? 0 : -1;
+}
+
+// --- Offline Rendering ---
+// Renders poses (one, or a replay recorded with --record) into image files at any resolution.
+// Frames are rendered in batches on the main thread, then each batch is encoded on all cores.
+typedef struct {
+    float x, y, angle;
+} Pose;
+
+typedef struct {
+    FrameTarget* frames;
+    const char* outPattern; // printf pattern taking the frame index, e.g. "shot_%04d.png"
+    int firstIndex;
+    int* failed;            // One result per frame, so workers never share a write
+} EncodeBatch;
+
+// Whether `pattern` is safe to hand to snprintf with the frame index: exactly one %d
+// conversion (with an optional digit width, e.g. %04d) and no other conversion but %%
+int isFramePattern(const char* pattern) {
+    int conversions = 0;
+    for (const char* p = pattern; *p; ++p) {
+        if (*p != '%') continue;
+        if (p[1] == '%') {
+            ++p;
+            continue;
+        }
+        ++p;
+        while (*p >= '0' && *p <= '9') ++p;
+        if (*p != 'd') return 0;
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+void encodeFrameTask(void* ctx, int index) {
+    EncodeBatch* batch = ctx;
+    char path[1024];
+    snprintf(path, sizeof(path), batch->outPattern, batch->firstIndex + index);
+    if (batch->failed[index]) return; // Not rendered
+    batch->failed[index] = writeFrameImage(path, &batch->frames[index]) != 0;
+}
+
+// Loads "x y angle" lines; returns the number of poses (0 on error)
+int loadReplay(const char* path, Pose** posesOut) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open replay %s\n", path);
+        return 0;
+    }
+    int count = 0, capacity = 256;
+    Pose* poses = malloc(capacity * sizeof(Pose));
+    Pose pose;
+    while (poses && fscanf(f, "%f %f %f", &pose.x, &pose.y, &pose.angle) == 3) {
+        if (count == capacity) {
+            capacity *= 2;
+            Pose* grown = realloc(poses, capacity * sizeof(Pose));
+            if (!grown) break;
+            poses = grown;
+        }
+        poses[count++] = pose;
+    }
+    fclose(f);
+    *posesOut = poses;
+    return count;
+}
+
+int runOfflineRender(const char* outPattern, int width, int height, const Pose* poses, int numPoses) {
+    int batchSize = cpuCount() * 2;
+    FrameTarget* frames = calloc(batchSize, sizeof(FrameTarget));
+    int* failed = calloc(batchSize, sizeof(int));
+    if (!frames || !failed) return 1;
+    for (int i = 0; i < batchSize; ++i) {
+        frames[i].width = width;
+        frames[i].height = height;
+        frames[i].chars = malloc((size_t)width * height);
+        frames[i].colors = malloc((size_t)width * height);
+        frames[i].zBuffer = malloc(sizeof(float) * width);
+        if (!frames[i].chars || !frames[i].colors || !frames[i].zBuffer) {
+            fprintf(stderr, "Out of memory for %dx%d frames\n", width, height);
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    for (int first = 0; first < numPoses; first += batchSize) {
+        int count = numPoses - first < batchSize ? numPoses - first : batchSize;
+        for (int i = 0; i < count; ++i) {
+            g_game.player.x = poses[first + i].x;
+            g_game.player.y = poses[first + i].y;
+            g_game.player.angle = poses[first + i].angle;
+            arenaReset(&g_game.arena);
+            failed[i] = renderScene(&g_game, &frames[i], &g_game.arena, sharedJobSystem()) != 0;
+            if (failed[i]) fprintf(stderr, "Out of memory rendering frame %d\n", first + i);
+        }
+        EncodeBatch batch = { .frames = frames, .outPattern = outPattern, .firstIndex = first, .failed = failed };
+        runParallel(count, encodeFrameTask, &batch);
+        for (int i = 0; i < count; ++i) failures += failed[i];
+    }
+
+    for (int i = 0; i < batchSize; ++i) {
+        free(frames[i].chars);
+        free(frames[i].colors);
+        free(frames[i].zBuffer);
+    }
+    free(frames);
+    free(failed);
+    printf("Rendered %d frame(s) at %dx%d\n", numPoses - failures, width, height);
+    return failures ? 1 : 0;
+}
+
+// Steps one environment at the terminal resolution with scripted actions and reports throughput
+int runEnvBenchmark(long steps) {
+    GameSession* env = envCreate(SCREEN_WIDTH, SCREEN_HEIGHT);
+    char* cells = malloc(SCREEN_WIDTH * SCREEN_HEIGHT);
+    char* colors = malloc(SCREEN_WIDTH * SCREEN_HEIGHT);
+    float* depth = malloc(sizeof(float) * SCREEN_WIDTH);
+    if (!env || !cells || !colors || !depth) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    EnvObservation obs = { .cells = cells, .colors = colors, .depth = depth };
+    envReset(env, &obs);
+    unsigned int script[] = { ACTION_FORWARD, ACTION_FORWARD | ACTION_TURN_LEFT, ACTION_SHOOT,
+                              ACTION_BACK | ACTION_STRAFE_RIGHT, ACTION_TURN_RIGHT, ACTION_INTERACT };
+    int scriptLength = sizeof(script) / sizeof(script[0]);
+    double start = nowSeconds();
+    for (long i = 0; i < steps; ++i) {
+        envStep(env, script[(i / 8) % scriptLength], &obs);
+        if (obs.done) envReset(env, &obs);
+    }
+    double elapsed = nowSeconds() - start;
+    printf("%ld steps in %.3f s: %.0f steps/s (%dx%d observations)\n",
+           steps, elapsed, elapsed > 0.0 ? steps / elapsed : 0.0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    free(cells);
+    free(colors);
+    free(depth);
+    envDestroy(env);
+    return 0;
+}
+
+// Same scripted run across a batch; each session starts at a different point in the script
+int runBatchBenchmark(long steps, int count, int threads) {
+    EnvBatch* batch = envBatchCreate(count, SCREEN_WIDTH, SCREEN_HEIGHT, threads);
+    size_t cellBytes = (size_t)count * SCREEN_WIDTH * SCREEN_HEIGHT;
+    char* cells = malloc(cellBytes);
+    char* colors = malloc(cellBytes);
+    float* depth = malloc(sizeof(float) * SCREEN_WIDTH * count);
+    EnvObservation* obs = calloc(count, sizeof(EnvObservation));
+    unsigned int* actions = calloc(count, sizeof(unsigned int));
+    if (!batch || !cells || !colors || !depth || !obs || !actions) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int e = 0; e < count; ++e) {
+        obs[e].cells = cells + (size_t)e * SCREEN_WIDTH * SCREEN_HEIGHT;
+        obs[e].colors = colors + (size_t)e * SCREEN_WIDTH * SCREEN_HEIGHT;
+        obs[e].depth = depth + (size_t)e * SCREEN_WIDTH;
+    }
+    envBatchReset(batch, obs);
+    unsigned int script[] = { ACTION_FORWARD, ACTION_FORWARD | ACTION_TURN_LEFT, ACTION_SHOOT,
+                              ACTION_BACK | ACTION_STRAFE_RIGHT, ACTION_TURN_RIGHT, ACTION_INTERACT };
+    int scriptLength = sizeof(script) / sizeof(script[0]);
+    long batchSteps = (steps + count - 1) / count;
+    double start = nowSeconds();
+    for (long i = 0; i < batchSteps; ++i) {
+        for (int e = 0; e < count; ++e) {
+            actions[e] = script[((i + e) / 8) % scriptLength];
+        }
+        envBatchStep(batch, actions, obs);
+    }
+    double elapsed = nowSeconds() - start;
+    printf("%ld steps in %.3f s: %.0f steps/s (%d sessions, %dx%d observations)\n", batchSteps * count,
+           elapsed, elapsed > 0.0 ? batchSteps * count / elapsed : 0.0, count, SCREEN_WIDTH, SCREEN_HEIGHT);
+    free(cells);
+    free(colors);
+    free(depth);
+    free(obs);
+    free(actions);
+    envBatchDestroy(batch);
+    return 0;
+}
+
+void printUsage(const char* program) {
+    printf("Usage: %s [--record FILE] [--publish SHM_NAME] [--sectors | --bsp] [--layers N] [--outline] [--wad FILE [--map NAME] [--cell UNITS] | --segments FILE]\n"
+           "       %s --render OUT_PATTERN [--size WxH] [--pose X,Y,ANGLE | --replay FILE] [--sectors | --bsp] [--outline]\n"
+           "       %s --bench-env STEPS [--batch SESSIONS] [--threads N]\n"
+           "OUT_PATTERN takes the frame index, e.g. shot_%%04d.png (.png or .ppm)\n"
+           "--sectors renders through a sector/portal map built from the grid (or --segments), --bsp\n"
+           "through a BSP tree compiled from that map\n"
+           "--layers keeps up to N bars/fences/windows per column (default %d, at most %d)\n"
+           "--outline draws outlines where depth jumps, for readability at low resolution\n"
+           "--wad plays a Doom-format WAD map (default: its first) at UNITS map units per cell (default %d)\n"
+           "--segments plays a level of convex sectors from a text file, rendered with --sectors or --bsp\n",
+           program, program, program, g_seeThroughLayers, SEE_THROUGH_MAX_LAYERS, WAD_DEFAULT_CELL_SIZE);
+}
+
+#ifndef MINIDOOM_LIBRARY
+int main(int argc, char** argv) {
+    const char* renderPattern = NULL;
+    const char* replayPath = NULL;
+    const char* recordPath = NULL;
+    const char* publishName = NULL;
+    int renderWidth = 1920, renderHeight = 1080;
+    long benchSteps = 0;
+    int batchSize = 0, batchThreads = 0;
+    int useSectors = 0, useBsp = 0;
+    int layers = g_seeThroughLayers;
+    const char* wadPath = NULL;
+    const char* segmentPath = NULL;
+    const char* wadMap = NULL;
+    int wadCellSize = WAD_DEFAULT_CELL_SIZE;
+    int poseGiven = 0;
+    Pose pose = { g_playerStart.x, g_playerStart.y, g_playerStart.angle };
+
+    for (int i = 1; i < argc; ++i) {
+        int hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--render") == 0 && hasValue) {
+            renderPattern = argv[++i];
+            if (!isFramePattern(renderPattern)) {
+                fprintf(stderr, "Bad --render '%s', expected one %%d for the frame index\n", renderPattern);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &renderWidth, &renderHeight) != 2 || renderWidth < 1 || renderHeight < 1) {
+                fprintf(stderr, "Bad --size '%s', expected WxH\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pose") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%f,%f,%f", &pose.x, &pose.y, &pose.angle) != 3) {
+                fprintf(stderr, "Bad --pose '%s', expected X,Y,ANGLE\n", argv[i]);
+                return 1;
+            }
+            poseGiven = 1;
+        } else if (strcmp(argv[i], "--replay") == 0 && hasValue) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && hasValue) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--publish") == 0 && hasValue) {
+            publishName = argv[++i];
+        } else if (strcmp(argv[i], "--bench-env") == 0 && hasValue) {
+            benchSteps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && hasValue) {
+            batchSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            batchThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sectors") == 0) {
+            useSectors = 1;
+        } else if (strcmp(argv[i], "--bsp") == 0) {
+            useBsp = 1;
+        } else if (strcmp(argv[i], "--outline") == 0) {
+            g_outlineEdges = 1;
+        } else if (strcmp(argv[i], "--layers") == 0 && hasValue) {
+            layers = atoi(argv[++i]);
+            if (layers < 0 || layers > SEE_THROUGH_MAX_LAYERS) {
+                fprintf(stderr, "Bad --layers '%s', expected 0-%d\n", argv[i], SEE_THROUGH_MAX_LAYERS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--wad") == 0 && hasValue) {
+            wadPath = argv[++i];
+        } else if (strcmp(argv[i], "--segments") == 0 && hasValue) {
+            segmentPath = argv[++i];
+        } else if (strcmp(argv[i], "--map") == 0 && hasValue) {
+            wadMap = argv[++i];
+        } else if (strcmp(argv[i], "--cell") == 0 && hasValue) {
+            wadCellSize = atoi(argv[++i]);
+            if (wadCellSize < 1) {
+                fprintf(stderr, "Bad --cell '%s', expected map units per cell\n", argv[i]);
+                return 1;
+            }
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    g_seeThroughLayers = layers;
+    if (wadPath && segmentPath) {
+        fprintf(stderr, "--wad and --segments both replace the level; pick one\n");
+        return 1;
+    }
+    if (wadPath || segmentPath) {
+        if (wadPath ? loadWadMap(wadPath, wadMap, wadCellSize) != 0 : loadSegmentMap(&g_sectorMap, segmentPath) != 0) return 1;
+        if (!poseGiven) pose = (Pose){ g_playerStart.x, g_playerStart.y, g_playerStart.angle };
+    }
+
+    if (benchSteps > 0) {
+        return batchSize > 0 ? runBatchBenchmark(benchSteps, batchSize, batchThreads)
+                             : runEnvBenchmark(benchSteps);
+    }
+
+    if (initRenderer() != 0) return 1;
+    if (initGameSession(&g_game, PARTICLE_CAPACITY) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (useSectors || useBsp || segmentPath) {
+        if ((!segmentPath && buildSectorMapFromGrid(&g_sectorMap) != 0) || (useBsp && buildBspTree(&g_bspTree, &g_sectorMap) != 0)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        g_game.sectorMap = &g_sectorMap;
+        if (useBsp) g_game.bspTree = &g_bspTree;
+    }
+
+    // --- Offline rendering (no terminal) ---
+    if (renderPattern) {
+        initCrcTable();
+        Pose* poses = &pose;
+        int numPoses = 1;
+        if (replayPath) {
+            numPoses = loadReplay(replayPath, &poses);
+            if (numPoses == 0) return 1;
+        }
+        int result = runOfflineRender(renderPattern, renderWidth, renderHeight, poses, numPoses);
+        if (poses != &pose) free(poses);
+        freeGameSession(&g_game);
+        freeBspTree(&g_bspTree);
+        freeSectorMap(&g_sectorMap);
+        return result;
+    }
+
+    FILE* recordFile = NULL;
+    if (recordPath) {
+        recordFile = fopen(recordPath, "w");
+        if (!recordFile) {
+            fprintf(stderr, "Cannot write %s\n", recordPath);
+            return 1;
+        }
+    }
+    if (publishName) {
+        g_game.obsWidth = SCREEN_WIDTH;
+        g_game.obsHeight = SCREEN_HEIGHT;
+        if (envPublish(&g_game, publishName) != 0) return 1;
+    }
+
 #ifndef _WIN32
     setupNonBlockingInput();
 #endif
     printf("Initializing Mini Doom CLI...\n"); 
 
-    // Initialize display and game elements
+    // Initialize display
     initializeDisplay();
-    initializeGameElements();
+    setupKeyboardProtocol();
 
     int gameRunning = 1;
-    char inputChar;
+    double lastTime = nowSeconds();
+    double tickAccumulator = 0.0;
 
     // Main game loop
     while (gameRunning) {
         // --- Input Handling ---
-#ifdef _WIN32
-        if (_kbhit()) {
-            inputChar = _getch();
-        } else {
-            inputChar = 0; // No input
-        }
-#else
-        inputChar = getch_linux();
-#endif
+        double frameStart = nowSeconds();
+        pollInput(frameStart);
 
-        float newPlayerX = g_player.x;
-        float newPlayerY = g_player.y;
-        int moveAttempt = 0;
-
-        // Process player input
-        switch (inputChar) {
-            case 'w':
-            case 'W':
-                newPlayerX += sin(g_player.angle) * PLAYER_MOVE_SPEED;
-                newPlayerY += cos(g_player.angle) * PLAYER_MOVE_SPEED;
-                moveAttempt = 1;
-                break;
-            case 's':
-            case 'S':
-                newPlayerX -= sin(g_player.angle) * PLAYER_MOVE_SPEED;
-                newPlayerY -= cos(g_player.angle) * PLAYER_MOVE_SPEED;
-                moveAttempt = 1;
-                break;
-            case 'a':
-            case 'A':
-                // Strafe left (perpendicular to current view)
-                newPlayerX += cos(g_player.angle) * PLAYER_MOVE_SPEED;
-                newPlayerY -= sin(g_player.angle) * PLAYER_MOVE_SPEED;
-                moveAttempt = 1;
-                break;
-            case 'd':
-            case 'D':
-                // Strafe right (perpendicular to current view)
-                newPlayerX -= cos(g_player.angle) * PLAYER_MOVE_SPEED;
-                newPlayerY += sin(g_player.angle) * PLAYER_MOVE_SPEED;
-                moveAttempt = 1;
-                break;
-            case 'q':
-            case 'Q':
-                g_player.angle -= PLAYER_ROT_SPEED;
-                break;
-            case 'e':
-            case 'E':
-                g_player.angle += PLAYER_ROT_SPEED;
-                break;
-            case 'f':
-            case 'F':
-                handleInteraction();
-                break;
-            case ' ': // Space bar for shooting
-                handleShooting();
-                break;
-            case 'x':
-            case 'X':
-                gameRunning = 0; // Set flag to exit game
-                break;
+        // --- Game Logic Update ---
+        // Fixed-size ticks keep motion independent of frame rate and of how many bytes arrived
+        tickAccumulator += frameStart - lastTime;
+        lastTime = frameStart;
+        if (tickAccumulator > MAX_TICKS_PER_FRAME * TICK_SECONDS) {
+            tickAccumulator = MAX_TICKS_PER_FRAME * TICK_SECONDS;
         }
+        while (tickAccumulator >= TICK_SECONDS && gameRunning) {
+            unsigned int actions = g_pendingActions;
+            g_pendingActions = 0;
+            if (actions & ACTION_EXIT) gameRunning = 0; // Set flag to exit game
 
-        // Apply movement if no collision occurs
-        if (moveAttempt && !checkCollision(newPlayerX, newPlayerY)) {
-            g_player.x = newPlayerX;
-            g_player.y = newPlayerY;
-        }
-        // Basic slide collision resolution (try moving along one axis if direct move fails)
-        else if (moveAttempt) {
-            // Try moving only in X direction
-            if (!checkCollision(newPlayerX, g_player.y)) {
-                g_player.x = newPlayerX;
+            tickGameSession(&g_game, heldKeyMask() | actions, TICK_SECONDS);
+            if (recordFile) {
+                fprintf(recordFile, "%.4f %.4f %.4f\n", g_game.player.x, g_game.player.y, g_game.player.angle);
             }
-            // Try moving only in Y direction
-            else if (!checkCollision(g_player.x, newPlayerY)) {
-                g_player.y = newPlayerY;
-            }
-        }
 
-        // --- Game Logic Update ---
-        // For a more complete game, enemy AI, health regeneration/damage over time,
-        // and other dynamic elements would be updated here.
-        if (g_player.health <= 0) {
-            gameRunning = 0; // End game if player health reaches zero
+            // For a more complete game, enemy AI, health regeneration/damage over time,
+            // and other dynamic elements would be updated here.
+            if (g_game.player.health <= 0) {
+                gameRunning = 0; // End game if player health reaches zero
+            }
+            tickAccumulator -= TICK_SECONDS;
         }
 
         // --- Render Frame ---
-        render();
+        render(&g_game, sharedJobSystem());
+        if (g_game.shared) {
+            publishSharedFrame(g_game.shared, &g_game.player, &g_screenBuffer[0][0], &g_colorBuffer[0][0], g_zBuffer);
+        }
 
         // --- Frame Rate Control ---
+        // Sleep until the next tick is due
+        double sleepSeconds = TICK_SECONDS - tickAccumulator - (nowSeconds() - frameStart);
+        if (sleepSeconds > 0) {
 #ifdef _WIN32
-        Sleep(50); // Pause for 50 milliseconds (approx. 20 FPS)
+            Sleep((DWORD)(sleepSeconds * 1000));
 #else
-        struct timespec ts;
-        ts.tv_sec = 0;
-        ts.tv_nsec = 50 * 1000000; // 50 milliseconds in nanoseconds
-        nanosleep(&ts, NULL);
+            struct timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = (long)(sleepSeconds * 1e9);
+            nanosleep(&ts, NULL);
 #endif
+        }
     }
 
     // --- Game Teardown ---
+    restoreKeyboardProtocol();
     finalizeDisplay();
 #ifndef _WIN32
     restoreBlockingInput(); // Restore terminal settings on Linux
 #endif
-    printf("Game Over! Your Score: %d\n", g_player.score);
+    if (recordFile) fclose(recordFile);
+    printf("Game Over! Your Score: %d\n", g_game.player.score);
+    printArenaReport(&g_game.arena);
+    freeGameSession(&g_game);
+    freeBspTree(&g_bspTree);
+    freeSectorMap(&g_sectorMap);
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,88 @@
+// --- Mini Doom environment API ---
+// Steps a game session without a terminal, sleeping or per-step allocation. Observation
+// buffers belong to the caller and are written in place on every step. Build the engine
+// with -DMINIDOOM_LIBRARY to leave out the terminal game's main().
+#ifndef MINIDOOM_H
+#define MINIDOOM_H
+
+#include <stdint.h>
+
+// Action bits for envStep(). Movement bits count as held for the whole step; the others fire
+// once per step they are set (crouch toggles).
+#define ACTION_FORWARD      (1u << 0)
+#define ACTION_BACK         (1u << 1)
+#define ACTION_STRAFE_LEFT  (1u << 2)
+#define ACTION_STRAFE_RIGHT (1u << 3)
+#define ACTION_TURN_LEFT    (1u << 4)
+#define ACTION_TURN_RIGHT   (1u << 5)
+#define ACTION_INTERACT     (1u << 6)
+#define ACTION_SHOOT        (1u << 7)
+#define ACTION_LOOK_UP      (1u << 8)
+#define ACTION_LOOK_DOWN    (1u << 9)
+#define ACTION_JUMP         (1u << 10)
+#define ACTION_CROUCH       (1u << 11)
+
+typedef struct GameSession GameSession;
+
+typedef struct {
+    // Caller-owned buffers, sized for the width and height given to envCreate()
+    char* cells;     // width * height glyphs, row-major
+    char* colors;    // width * height color indices (0 = none, 1-6 = cyan, blue, gray, green, yellow, red)
+    float* depth;    // width wall distances (the z-buffer row)
+
+    // Written every step
+    float x, y, angle;
+    int health, ammo, score;
+    float reward;    // Score gained during the step
+    int done;        // Player is dead; call envReset()
+} EnvObservation;
+
+// Returns NULL if the observation size is invalid, the sprite art does not fit, or memory runs out
+GameSession* envCreate(int width, int height);
+// Both return 0, or -1 if the frame could not be rendered (out of memory); the stats are still written
+int envReset(GameSession* env, EnvObservation* obs);
+int envStep(GameSession* env, unsigned int action, EnvObservation* obs);
+void envDestroy(GameSession* env);
+
+// Replaces the level with map `mapName` ("E1M1", "MAP01", or NULL for the first) of a
+// Doom-format WAD, rasterised at `cellSize` map units per cell (64 is a good start; at most
+// 128x128 cells fit). The level is shared by every session, so call it before any envCreate()
+// or envBatchCreate(); it fails while sessions exist. Returns 0 on success, and keeps the
+// current level on failure.
+int loadWadMap(const char* path, const char* mapName, int cellSize);
+
+// Batches step `count` sessions in lockstep over `threads` threads (0 = one per core). `actions`
+// and `obs` hold one entry per session. A session that is done restarts on its next step, and
+// that step's observation is the fresh start.
+typedef struct EnvBatch EnvBatch;
+
+EnvBatch* envBatchCreate(int count, int width, int height, int threads);
+void envBatchReset(EnvBatch* batch, EnvObservation* obs);
+void envBatchStep(EnvBatch* batch, const unsigned int* actions, EnvObservation* obs);
+void envBatchDestroy(EnvBatch* batch);
+
+// --- Shared frame export ---
+// A published session mirrors its latest frame into a POSIX shared-memory object
+// (/dev/shm/NAME), laid out as this header followed by the cells, colors and depth row at the
+// given offsets. The writer never waits for readers. To read without tearing:
+//   1. s1 = sequence (acquire load); if odd, an update is in progress, try again
+//   2. read the fields and buffers you need, in place
+//   3. s2 = sequence (acquire fence, then load); if s2 != s1 the frame changed, discard and retry
+#define MINIDOOM_SHARED_MAGIC   0x4D44464Du // "MFDM" little-endian
+#define MINIDOOM_SHARED_VERSION 1
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t width, height;
+    uint32_t sequence;  // Seqlock counter, odd while the writer is mid-update
+    uint32_t frame;     // Frames published so far
+    float x, y, angle;
+    int32_t health, ammo, score;
+    uint32_t cellsOffset, colorsOffset, depthOffset; // Bytes from the start of the region
+} MinidoomSharedFrame;
+
+// Creates (or replaces) the named region and publishes every later reset and step into it.
+// Returns 0 on success; the region is unlinked when the session is destroyed.
+int envPublish(GameSession* env, const char* name);
+
+#endif
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Builds a one-map Doom PWAD from an ASCII grid, to check the --wad loader.
+
+The grid uses the built-in level's glyphs: '#' wall, 'D' door, 'H' health,
+'A' ammo, 'E' monster, 'P' the player start (facing east), anything else floor.
+Every cell becomes a UNITS-wide square, so loading the WAD with --cell UNITS
+should give back the same grid.
+
+    python3 tools/mkwad.py level.txt level.wad [UNITS]
+    ./minidoom --wad level.wad --cell UNITS --bench-env 1000
+"""
+import struct
+import sys
+
+THING_TYPES = {'H': 2012, 'A': 2007, 'E': 3001, 'P': 1}  # Medikit, clip, imp, player 1
+FLOOR_SECTOR, DOOR_SECTOR = 0, 1
+
+
+def cell_kind(rows, x, y):
+    if y < 0 or y >= len(rows) or x < 0 or x >= len(rows[y]):
+        return '#'
+    c = rows[y][x]
+    return c if c in '#D' else '.'
+
+
+def grid_to_wad(rows, unit):
+    height = len(rows)
+    vertices, vertex_ids = [], {}
+    lines, sides, things = [], [], []
+
+    def vertex(x, y):
+        if (x, y) not in vertex_ids:
+            vertex_ids[(x, y)] = len(vertices)
+            vertices.append((x, y))
+        return vertex_ids[(x, y)]
+
+    def side(sector):
+        sides.append(sector)
+        return len(sides) - 1
+
+    # Grid y grows down, map y grows up; lines run clockwise around their front sector
+    for y, row in enumerate(rows):
+        for x, c in enumerate(row):
+            kind = cell_kind(rows, x, y)
+            if kind == '#':
+                continue
+            left, right = x * unit, (x + 1) * unit
+            top, bottom = (height - y) * unit, (height - y - 1) * unit
+            edges = (((-1, 0), (left, bottom), (left, top)),
+                     ((1, 0), (right, top), (right, bottom)),
+                     ((0, -1), (left, top), (right, top)),
+                     ((0, 1), (right, bottom), (left, bottom)))
+            for (dx, dy), start, end in edges:
+                other = cell_kind(rows, x + dx, y + dy)
+                if other == kind or (kind == 'D' and other != '#'):
+                    continue  # Door edges next to floor come from the floor side
+                sector = DOOR_SECTOR if kind == 'D' else FLOOR_SECTOR
+                if other == '#':
+                    lines.append((vertex(*start), vertex(*end), 1, side(sector), 0xFFFF))  # Impassable
+                else:
+                    lines.append((vertex(*start), vertex(*end), 4, side(sector), side(DOOR_SECTOR)))
+            if c in THING_TYPES:
+                things.append((left + unit // 2, bottom + unit // 2, 0, THING_TYPES[c], 7))
+
+    sector = '<hh8s8shhh'
+    lumps = [
+        (b'MAP01', b''),
+        (b'THINGS', b''.join(struct.pack('<5h', *t) for t in things)),
+        (b'LINEDEFS', b''.join(struct.pack('<HHhhhHH', a, b, flags, 0, 0, front, back)
+                               for a, b, flags, front, back in lines)),
+        (b'SIDEDEFS', b''.join(struct.pack('<hh8s8s8sh', 0, 0, b'-', b'-', b'STARTAN3', s) for s in sides)),
+        (b'VERTEXES', b''.join(struct.pack('<hh', x, y) for x, y in vertices)),
+        (b'SECTORS', struct.pack(sector, 0, 128, b'FLOOR4_8', b'CEIL3_5', 160, 0, 0) +
+                     struct.pack(sector, 0, 0, b'FLOOR4_8', b'CEIL3_5', 160, 0, 0)),  # Doors start shut
+    ]
+    data, directory = b'', b''
+    for name, body in lumps:
+        directory += struct.pack('<ii8s', 12 + len(data), len(body), name)
+        data += body
+    return b'PWAD' + struct.pack('<ii', len(lumps), 12 + len(data)) + data + directory
+
+
+if __name__ == '__main__':
+    if len(sys.argv) not in (3, 4):
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as f:
+        rows = [line.rstrip('\n') for line in f if line.strip()]
+    unit = int(sys.argv[3]) if len(sys.argv) == 4 else 64
+    with open(sys.argv[2], 'wb') as f:
+        f.write(grid_to_wad(rows, unit))